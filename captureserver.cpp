@@ -0,0 +1,72 @@
+#include "captureserver.h"
+#include "monotonic.h"
+#include "remotelink.h"
+#include <QHostAddress>
+#include <QJsonDocument>
+#include <QWebSocket>
+#include <QWebSocketServer>
+
+CaptureServer::CaptureServer(FILE *out, bool cbor, QObject *parent) : QObject{parent}, out_(out), start_(monotonicNs()), count_(0)
+{
+    server_ = new QWebSocketServer("tvcec capture", QWebSocketServer::NonSecureMode, this);
+    connect(server_, &QWebSocketServer::newConnection, this, &CaptureServer::newConnection);
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    if (cbor)
+    {
+        server_->setSupportedSubprotocols(QStringList() << RemoteLink::kCborProtocol);
+    }
+#endif
+}
+
+CaptureServer::~CaptureServer()
+{
+    server_->close();
+    qDeleteAll(clients_);
+    fflush(out_);
+}
+
+bool CaptureServer::listen(quint16 port)
+{
+    return server_->listen(QHostAddress::LocalHost, port);
+}
+
+quint16 CaptureServer::port() const
+{
+    return server_->serverPort();
+}
+
+void CaptureServer::newConnection()
+{
+    while (QWebSocket *sock = server_->nextPendingConnection())
+    {
+        connect(sock, &QWebSocket::textMessageReceived, this, &CaptureServer::textMessage);
+        connect(sock, &QWebSocket::binaryMessageReceived, this, &CaptureServer::binaryMessage);
+        connect(sock, &QWebSocket::disconnected, this, &CaptureServer::disconnected);
+        clients_.append(sock);
+    }
+}
+
+void CaptureServer::textMessage(const QString &msg)
+{
+    count_++;
+    fprintf(out_, "%10.3f %s\n", (monotonicNs() - start_) / 1000000.0, qPrintable(msg));
+    fflush(out_);
+}
+
+void CaptureServer::binaryMessage(const QByteArray &msg)
+{
+    count_++;
+    QByteArray json = QJsonDocument(RemoteLink::decodeCbor(msg)).toJson(QJsonDocument::Compact);
+    fprintf(out_, "%10.3f cbor %s\n", (monotonicNs() - start_) / 1000000.0, json.constData());
+    fflush(out_);
+}
+
+void CaptureServer::disconnected()
+{
+    QWebSocket *sock = qobject_cast<QWebSocket *>(sender());
+    if (sock)
+    {
+        clients_.removeAll(sock);
+        sock->deleteLater();
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef CAPTURESERVER_H
+#define CAPTURESERVER_H
+
+#include <stdio.h>
+#include <QList>
+#include <QObject>
+
+class QWebSocket;
+class QWebSocketServer;
+
+//  Stand-in remote
+//
+//  Local websocket server that accepts tvcec connections in place of a real
+//  remote and writes each message it receives, with its arrival time in msec
+//  since the server started, to a file. CBOR messages are written as JSON
+//  with a "cbor" prefix.
+class CaptureServer : public QObject
+{
+    Q_OBJECT
+
+private:
+    QWebSocketServer    *server_;               // Listening server
+    QList<QWebSocket *> clients_;               // Connected clients
+    FILE                *out_;                  // Capture output
+    qint64              start_;                 // Monotonic nsec at construction
+    int                 count_;                 // Messages captured
+
+public:
+    explicit CaptureServer(FILE *out, bool cbor = true, QObject *parent = nullptr);
+    virtual ~CaptureServer();
+
+    bool listen(quint16 port = 0);
+    quint16 port() const;
+    int count() const {return count_;}
+
+private slots:
+    void newConnection();
+    void textMessage(const QString &msg);
+    void binaryMessage(const QByteArray &msg);
+    void disconnected();
+};
+
+#endif // CAPTURESERVER_H
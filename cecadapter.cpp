@@ -0,0 +1,23 @@
+#include "cecadapter.h"
+
+// cecloader.h uses std::cout _without_ including iosfwd or iostream
+// Furthermore is uses cout and not std::cout
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <libcec/cecloader.h>
+
+LibCECAdapter *LibCECAdapter::create(CEC::libcec_configuration *config)
+{
+    CEC::ICECAdapter *adapter = LibCecInitialise(config);
+    if (!adapter)
+    {
+        return nullptr;
+    }
+    return new LibCECAdapter(adapter);
+}
+
+LibCECAdapter::~LibCECAdapter()
+{
+    UnloadLibCec(adapter_);
+}
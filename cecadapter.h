@@ -0,0 +1,78 @@
+#ifndef CECADAPTER_H
+#define CECADAPTER_H
+
+#include <stdint.h>
+#include <string>
+#include <libcec/cec.h>
+
+//  CEC adapter interface
+//
+//  The part of CEC::ICECAdapter that tvcec uses, with the same method names, so
+//  CECAudio and CECDeviceCache run unchanged against libcec or a replayed trace.
+class CECAdapter
+{
+public:
+    virtual ~CECAdapter() {}
+
+    virtual bool SetCallbacks(CEC::ICECCallbacks *callbacks, void *cbParam) = 0;
+    virtual int8_t DetectAdapters(CEC::cec_adapter_descriptor *deviceList, uint8_t iBufSize,
+                                  const char *strDevicePath = nullptr, bool bQuickScan = false) = 0;
+    virtual bool Open(const char *strPort, uint32_t iTimeoutMs = 10000) = 0;
+    virtual void Close() = 0;
+
+    virtual bool Transmit(const CEC::cec_command &data) = 0;
+    virtual bool SendKeypress(CEC::cec_logical_address iDestination, CEC::cec_user_control_code key, bool bWait = false) = 0;
+    virtual bool SendKeyRelease(CEC::cec_logical_address iDestination, bool bWait = false) = 0;
+
+    virtual CEC::cec_power_status GetDevicePowerStatus(CEC::cec_logical_address iLogicalAddress) = 0;
+    virtual CEC::cec_logical_address GetActiveSource() = 0;
+    virtual CEC::cec_logical_addresses GetActiveDevices() = 0;
+    virtual uint16_t GetDevicePhysicalAddress(CEC::cec_logical_address iLogicalAddress) = 0;
+    virtual std::string GetDeviceOSDName(CEC::cec_logical_address iAddress) = 0;
+    virtual uint32_t GetDeviceVendorId(CEC::cec_logical_address iLogicalAddress) = 0;
+
+    virtual const char *ToString(const CEC::cec_opcode opcode) = 0;
+    virtual const char *ToString(const CEC::cec_power_status status) = 0;
+};
+
+//  The real adapter through libcec
+class LibCECAdapter : public CECAdapter
+{
+private:
+    CEC::ICECAdapter    *adapter_;
+
+    explicit LibCECAdapter(CEC::ICECAdapter *adapter) : adapter_(adapter) {}
+
+public:
+    static LibCECAdapter *create(CEC::libcec_configuration *config);
+    virtual ~LibCECAdapter();
+
+    bool SetCallbacks(CEC::ICECCallbacks *callbacks, void *cbParam) override
+            {return adapter_->SetCallbacks(callbacks, cbParam);}
+    int8_t DetectAdapters(CEC::cec_adapter_descriptor *deviceList, uint8_t iBufSize,
+                          const char *strDevicePath = nullptr, bool bQuickScan = false) override
+            {return adapter_->DetectAdapters(deviceList, iBufSize, strDevicePath, bQuickScan);}
+    bool Open(const char *strPort, uint32_t iTimeoutMs = 10000) override {return adapter_->Open(strPort, iTimeoutMs);}
+    void Close() override {adapter_->Close();}
+
+    bool Transmit(const CEC::cec_command &data) override {return adapter_->Transmit(data);}
+    bool SendKeypress(CEC::cec_logical_address iDestination, CEC::cec_user_control_code key, bool bWait = false) override
+            {return adapter_->SendKeypress(iDestination, key, bWait);}
+    bool SendKeyRelease(CEC::cec_logical_address iDestination, bool bWait = false) override
+            {return adapter_->SendKeyRelease(iDestination, bWait);}
+
+    CEC::cec_power_status GetDevicePowerStatus(CEC::cec_logical_address iLogicalAddress) override
+            {return adapter_->GetDevicePowerStatus(iLogicalAddress);}
+    CEC::cec_logical_address GetActiveSource() override {return adapter_->GetActiveSource();}
+    CEC::cec_logical_addresses GetActiveDevices() override {return adapter_->GetActiveDevices();}
+    uint16_t GetDevicePhysicalAddress(CEC::cec_logical_address iLogicalAddress) override
+            {return adapter_->GetDevicePhysicalAddress(iLogicalAddress);}
+    std::string GetDeviceOSDName(CEC::cec_logical_address iAddress) override {return adapter_->GetDeviceOSDName(iAddress);}
+    uint32_t GetDeviceVendorId(CEC::cec_logical_address iLogicalAddress) override
+            {return adapter_->GetDeviceVendorId(iLogicalAddress);}
+
+    const char *ToString(const CEC::cec_opcode opcode) override {return adapter_->ToString(opcode);}
+    const char *ToString(const CEC::cec_power_status status) override {return adapter_->ToString(status);}
+};
+
+#endif // CECADAPTER_H
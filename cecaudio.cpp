@@ -1,19 +1,20 @@
 #include "cecaudio.h"
 #include "ceclog.h"
+#include "cectrace.h"
+#include "metrics.h"
+#include "monotonic.h"
 #include <algorithm>
 #include <array>
-#include <QMutexLocker>
+#include <stdio.h>
+#include <unistd.h>
+#include <QThread>
 #include <QtDebug>
 
-// cecloader.h uses std::cout _without_ including iosfwd or iostream
-// Furthermore is uses cout and not std::cout
-#include <iostream>
-using std::cout;
-using std::endl;
-#include <libcec/cecloader.h>
-
-CECAudio::CECAudio(CECLog *logger) : log_(logger), tv_power_(CEC::CEC_POWER_STATUS_STANDBY), active_device_(CEC::CECDEVICE_UNKNOWN),
-    log_level_(CEC::CEC_LOG_ERROR), volume_(60), muted_(false)
+CECAudio::CECAudio(CECLog *logger, CECTrace *trace, Metrics *metrics) : cec_adapter(nullptr), log_(logger), trace_(trace), metrics_(metrics),
+    last_rx_ns_(0), tv_power_(CEC::CEC_POWER_STATUS_STANDBY), active_device_(CEC::CECDEVICE_UNKNOWN),
+    log_level_(CEC::CEC_LOG_ERROR), audio_status_(60), last_audio_status_(-1), predict_step_(0), pending_physical_(-1), scan_requested_(false),
+    active_restored_(false), discovery_running_(true),
+    worker_running_(true), queue_high_(0)
 {
     cec_config.Clear();
     cec_callbacks.Clear();
@@ -39,95 +40,274 @@ CECAudio::CECAudio(CECLog *logger) : log_(logger), tv_power_(CEC::CEC_POWER_STAT
     audio_timer_->setSingleShot(true);
     connect(audio_timer_, &QTimer::timeout, this, &CECAudio::audio_status_timeout);
     connect(this, &CECAudio::triggerVolumeTimer, audio_timer_, qOverload<>(&QTimer::start));
+
+    devices_.setListener([this](CEC::cec_logical_address addr, CECDeviceCache::Field field) {deviceUpdated(addr, field);});
+
+    sem_init(&scan_wake_, 0, 0);
+    sem_init(&worker_wake_, 0, 0);
+    worker_ = std::thread(&CECAudio::workerLoop, this);
 }
 
 CECAudio::~CECAudio()
 {
-    // Close down and cleanup
+    // Close down and cleanup; every thread that uses the adapter stops before it goes
+    if (discovery_.joinable())
+    {
+        discovery_running_.store(false);
+        sem_post(&scan_wake_);
+        discovery_.join();
+    }
+    devices_.stop();
+    stopWorker();
     if (cec_adapter)
     {
         cec_adapter->Close();
-        UnloadLibCec(cec_adapter);
+        delete cec_adapter;
+    }
+    sem_destroy(&worker_wake_);
+    sem_destroy(&scan_wake_);
+}
+
+void CECAudio::setAdapter(CECAdapter *adapter)
+{
+    //  Takes ownership; without one init() loads libcec
+    delete cec_adapter;
+    cec_adapter = adapter;
+}
+
+void CECAudio::restore(CEC::cec_power_status power, CEC::cec_logical_address active, const std::string &osdname,
+                       const uint16_t *physical)
+{
+    //  Before init(): start from what the last run knew. Nothing is announced;
+    //  bus discovery replaces whatever has changed since
+    for (int ii = CEC::CECDEVICE_TV; ii < CEC::CECDEVICE_BROADCAST; ii++)
+    {
+        if (physical[ii] != CECTopology::kUnknown)
+        {
+            topology_.update(static_cast<CEC::cec_logical_address>(ii), physical[ii]);
+        }
+    }
+    if (power != CEC::CEC_POWER_STATUS_UNKNOWN)
+    {
+        tv_power_ = power;
+        devices_.setPower(CEC::CECDEVICE_TV, power);
+    }
+    if (active != CEC::CECDEVICE_UNKNOWN)
+    {
+        if (!osdname.empty())
+        {
+            devices_.setOSDName(active, osdname);
+        }
+        active_device_ = active;
+        active_restored_ = true;
     }
 }
 
 bool CECAudio::init()
 {
     // Get a cec adapter by initialising the cec library
-    cec_adapter = LibCecInitialise(&cec_config);
+    if (!cec_adapter)
+    {
+        cec_adapter = LibCECAdapter::create(&cec_config);
+    }
     if( !cec_adapter )
     {
-        std::cerr << "Failed loading libcec.so\n";
+        CECLOG(log_, General, Error, "Failed loading libcec.so");
         return false;
     }
 
     //  Enable callbacks
     cec_adapter->SetCallbacks(&cec_callbacks, this);
 
+    int64_t start = monotonicNs();
+    if (!openAdapter())
+    {
+        delete cec_adapter;
+        cec_adapter = nullptr;
+        return false;
+    }
+    int64_t opened = monotonicNs();
+
+    //  The bus is usable now; what is on it is found out in the background so
+    //  volume keys work while the TV and sources are still being queried
+    devices_.track(CEC::CECDEVICE_TV, CECDeviceCache::Power);
+    devices_.start(cec_adapter);
+    discovery_ = std::thread(&CECAudio::discoverBus, this);
+    CECLOG(log_, General, Info, "CECAudio initialized. Adapter open %d msec", static_cast<int>((opened - start) / 1000000));
+    return true;
+}
+
+bool CECAudio::openAdapter()
+{
+    //  An adapter named on the command line is opened as is
+    if (!port_.empty())
+    {
+        int64_t start = monotonicNs();
+        if (!cec_adapter->Open(port_.c_str()))
+        {
+            CECLOG(log_, General, Error, "Failed to open the CEC device on port %s", port_.c_str());
+            return false;
+        }
+        CECLOG(log_, General, Info, "Opened CEC adapter %s in %d msec", port_.c_str(), static_cast<int>((monotonicNs() - start) / 1000000));
+        return true;
+    }
+
+    //  Try the port that worked last time before scanning for adapters
+    std::string cached;
+    if (!adapter_cache_.empty())
+    {
+        if (FILE *fp = fopen(adapter_cache_.c_str(), "r"))
+        {
+            char port[sizeof(CEC::cec_adapter_descriptor::strComName)];
+            if (fgets(port, sizeof(port), fp))
+            {
+                cached = port;
+                cached.erase(cached.find_last_not_of("\r\n") + 1);
+            }
+            fclose(fp);
+        }
+    }
+    if (!cached.empty() && (cached[0] != '/' || access(cached.c_str(), F_OK) == 0))
+    {
+        int64_t start = monotonicNs();
+        if (cec_adapter->Open(cached.c_str()))
+        {
+            CECLOG(log_, General, Info, "Opened cached CEC adapter %s in %d msec", cached.c_str(),
+                   static_cast<int>((monotonicNs() - start) / 1000000));
+            port_ = cached;
+            return true;
+        }
+        CECLOG(log_, General, Info, "Cached CEC adapter %s did not open, scanning", cached.c_str());
+    }
+
     // Try to automatically determine the CEC devices
+    int64_t start = monotonicNs();
     std::array<CEC::cec_adapter_descriptor,10> devices;
     int8_t devices_found = cec_adapter->DetectAdapters(devices.data(), devices.size(), nullptr, true /*quickscan*/);
     if( devices_found <= 0)
     {
-        std::cerr << "Could not automatically determine the cec adapter devices\n";
-        UnloadLibCec(cec_adapter);
+        CECLOG(log_, General, Error, "Could not automatically determine the cec adapter devices");
         return false;
     }
+    int64_t detected = monotonicNs();
 
     // Open a connection to the zeroth CEC device
     if( !cec_adapter->Open(devices[0].strComName) )
     {
-        std::cerr << "Failed to open the CEC device on port " << devices[0].strComName << std::endl;
-        UnloadLibCec(cec_adapter);
+        CECLOG(log_, General, Error, "Failed to open the CEC device on port %s", devices[0].strComName);
         return false;
     }
+    CECLOG(log_, General, Info, "Opened CEC adapter %s: detect %d msec, open %d msec", devices[0].strComName,
+           static_cast<int>((detected - start) / 1000000), static_cast<int>((monotonicNs() - detected) / 1000000));
+    port_ = devices[0].strComName;
 
-    //  Get the power and active source
-    tv_power_ = getTVPower();
-    active_device_ = getActiveAddress();
-    log_->print("CECAudio initialized. tv_power_ %d, active_device_ %d", tv_power_, active_device_);
+    if (!adapter_cache_.empty() && cached != devices[0].strComName)
+    {
+        if (FILE *fp = fopen(adapter_cache_.c_str(), "w"))
+        {
+            fprintf(fp, "%s\n", devices[0].strComName);
+            fclose(fp);
+        }
+    }
     return true;
 }
 
+void CECAudio::discoverBus()
+{
+    //  Runs on its own thread; results observed from traffic meanwhile are newer, so keep them
+    int64_t start = monotonicNs();
+    int64_t age;
+    CEC::cec_power_status power = cec_adapter->GetDevicePowerStatus(CEC::CECDEVICE_TV);
+    devices_.power(CEC::CECDEVICE_TV, &age);
+    if (age < 0 || age > (monotonicNs() - start) / 1000000)
+    {
+        devices_.setPower(CEC::CECDEVICE_TV, power);
+    }
+    int64_t powered = monotonicNs();
+
+    CEC::cec_logical_address active = cec_adapter->GetActiveSource();
+    QMetaObject::invokeMethod(this, [this, active]()
+    {
+        if ((active_device() == CEC::CECDEVICE_UNKNOWN || active_restored_) && active != CEC::CECDEVICE_UNKNOWN)
+        {
+            setActive_device(active);
+        }
+    }, Qt::QueuedConnection);
+    CECLOG(log_, General, Info, "Bus discovery: tv power %d (%d msec), active source %d (%d msec)", power,
+           static_cast<int>((powered - start) / 1000000), active,
+           static_cast<int>((monotonicNs() - powered) / 1000000));
+
+    //  The thread stays for later scans so their blocking queries stay off the Qt thread and the worker
+    scanTopology();
+    while (true)
+    {
+        sem_wait(&scan_wake_);
+        if (!discovery_running_.load())
+        {
+            break;
+        }
+        if (scan_requested_.load())
+        {
+            scanTopology();
+        }
+    }
+}
+
 
 CEC::cec_power_status CECAudio::tv_power() const
 {
-    return tv_power_;
+    return tv_power_.load(std::memory_order_relaxed);
 }
 
 void CECAudio::setTv_power(CEC::cec_power_status newTv_power)
 {
-    if (tv_power_ == newTv_power)
-        return;
-    tv_power_ = newTv_power;
-    if (log_level_ & CEC::CEC_LOG_DEBUG)
+    //  Only the Qt thread writes it, so changes are announced in the order they happen
+    if (QThread::currentThread() != thread())
     {
-        std::cout << "TV Power = " << cec_adapter->ToString(tv_power_) << " (" << tv_power_ << ")" << endl;
+        QMetaObject::invokeMethod(this, [this, newTv_power]() {setTv_power(newTv_power);}, Qt::QueuedConnection);
+        return;
     }
-    emit tv_powerChanged(tv_power_);
+    if (tv_power_.load(std::memory_order_relaxed) == newTv_power)
+        return;
+    tv_power_.store(newTv_power, std::memory_order_relaxed);
+    devices_.setPower(CEC::CECDEVICE_TV, newTv_power);
+    CECLOG(log_, CecRx, Trace, "TV power %s (%d)", cec_adapter->ToString(newTv_power), newTv_power);
+    emit tv_powerChanged(newTv_power);
 }
 
 CEC::cec_logical_address CECAudio::active_device() const
 {
-    return active_device_;
+    return active_device_.load(std::memory_order_relaxed);
 }
 
 void CECAudio::setActive_device(const CEC::cec_logical_address &newActive_device)
 {
-    if (active_device_ == newActive_device)
+    //  Only the Qt thread writes it, as for the TV power
+    if (QThread::currentThread() != thread())
+    {
+        CEC::cec_logical_address active = newActive_device;
+        QMetaObject::invokeMethod(this, [this, active]() {setActive_device(active);}, Qt::QueuedConnection);
         return;
-    active_device_ = newActive_device;
-    std::string osdname = cec_adapter->GetDeviceOSDName(active_device_);
-    if (tv_power_ != CEC::CEC_POWER_STATUS_ON)
+    }
+    active_restored_ = false;
+    if (active_device_.load(std::memory_order_relaxed) == newActive_device)
+        return;
+    active_device_.store(newActive_device, std::memory_order_relaxed);
+
+    //  Use the cached name now; a refresh re-announces the device if the name changes
+    int64_t age;
+    std::string osdname = devices_.osdName(newActive_device, &age);
+    devices_.track(newActive_device, CECDeviceCache::Name | CECDeviceCache::Vendor);
+    if (age < 0)
     {
-        CEC::cec_power_status tvpower = cec_adapter->GetDevicePowerStatus(CEC::CECDEVICE_TV);
-        setTv_power(tvpower);
+        devices_.requestRefresh(newActive_device, CECDeviceCache::Name);
     }
-    if (log_level_ & CEC::CEC_LOG_DEBUG)
+    if (tv_power() != CEC::CEC_POWER_STATUS_ON)
     {
-        std::cout << "Active device = " << active_device_ << " name = " << osdname << endl;
+        devices_.requestRefresh(CEC::CECDEVICE_TV, CECDeviceCache::Power);
     }
-    emit active_deviceChanged(active_device_, osdname);
+    CECLOG(log_, CecRx, Trace, "Active device %d (%s)", newActive_device, osdname.c_str());
+    emit active_deviceChanged(newActive_device, osdname);
 }
 
 CEC::cec_log_level CECAudio::log_level() const
@@ -142,68 +322,145 @@ void CECAudio::setLog_level(CEC::cec_log_level newLog_level)
 
 void CECAudio::setVolume(int volume)
 {
-    QMutexLocker lk(&audioMtx1_);
-    volume_ = volume;
+    if (volume < CEC::CEC_AUDIO_VOLUME_MIN)
+    {
+        volume = CEC::CEC_AUDIO_VOLUME_MIN;
+    }
+    if (volume > CEC::CEC_AUDIO_VOLUME_MAX)
+    {
+        volume = CEC::CEC_AUDIO_VOLUME_MAX;
+    }
+    uint8_t status = audio_status_.load(std::memory_order_relaxed);
+    while (!audio_status_.compare_exchange_weak(status, (status & CEC::CEC_AUDIO_MUTE_STATUS_MASK) |
+                                                (static_cast<uint8_t>(volume) & CEC::CEC_AUDIO_VOLUME_STATUS_MASK),
+                                                std::memory_order_relaxed))
+    {
+    }
 }
 
 void CECAudio::setMuted(bool muted)
 {
-    QMutexLocker lk(&audioMtx1_);
-    muted_ = muted;
+    if (muted)
+    {
+        audio_status_.fetch_or(CEC::CEC_AUDIO_MUTE_STATUS_MASK, std::memory_order_relaxed);
+    }
+    else
+    {
+        audio_status_.fetch_and(static_cast<uint8_t>(~CEC::CEC_AUDIO_MUTE_STATUS_MASK), std::memory_order_relaxed);
+    }
 }
 
-void CECAudio::sendUserKeyPress(CEC::cec_user_control_code key, int releaseDelay)
+void CECAudio::predictVolume(CEC::cec_user_control_code key)
 {
-    cec_adapter->SendKeypress(active_device(), key);
-    if (releaseDelay > 0)
+    //  Model the amplifier: volume keys step and unmute, mute toggles
+    int step = predict_step_.load(std::memory_order_relaxed);
+    uint8_t status = audio_status_.load(std::memory_order_relaxed);
+    uint8_t next;
+    do
     {
-        QTimer::singleShot(releaseDelay, this, &CECAudio::sendUserKeyRelease);
+        int vol = status & CEC::CEC_AUDIO_VOLUME_STATUS_MASK;
+        switch (key)
+        {
+        case CEC::CEC_USER_CONTROL_CODE_VOLUME_UP:
+            vol = std::min(vol + step, static_cast<int>(CEC::CEC_AUDIO_VOLUME_MAX));
+            next = static_cast<uint8_t>(vol);
+            break;
+
+        case CEC::CEC_USER_CONTROL_CODE_VOLUME_DOWN:
+            vol = std::max(vol - step, static_cast<int>(CEC::CEC_AUDIO_VOLUME_MIN));
+            next = static_cast<uint8_t>(vol);
+            break;
+
+        case CEC::CEC_USER_CONTROL_CODE_MUTE:
+            next = status ^ CEC::CEC_AUDIO_MUTE_STATUS_MASK;
+            break;
+
+        default:
+            return;
+        }
     }
+    while (!audio_status_.compare_exchange_weak(status, next, std::memory_order_relaxed));
+
+    //  Report at once rather than after the debounce so the TV overlay follows the keys
+    sendAudioStatus(CEC::CECDEVICE_TV, true);
+    emit audioStatusChanged(next & CEC::CEC_AUDIO_VOLUME_STATUS_MASK, (next & CEC::CEC_AUDIO_MUTE_STATUS_MASK) != 0);
 }
 
-void CECAudio::sendUserKeyRelease()
+void CECAudio::reportAudioStatus()
 {
-    cec_adapter->SendKeyRelease(active_device());
+    sendAudioStatus(CEC::CECDEVICE_TV, true);
 }
 
-void CECAudio::audio_status_timeout()
+bool CECAudio::sendUserKeyPress(CEC::cec_user_control_code key, int releaseDelay)
 {
-    uint8_t status = audioStatus();
-    if (status != last_audio_status_)
+    bool ret = cec_adapter->SendKeypress(active_device(), key);
+    traceKey(CEC::CEC_OPCODE_USER_CONTROL_PRESSED, key);
+    if (releaseDelay > 0)
     {
-        sendAudioStatus();
+        QTimer::singleShot(releaseDelay, this, &CECAudio::sendUserKeyRelease);
     }
+    return ret;
 }
 
-uint8_t CECAudio::audioStatus() const
+bool CECAudio::sendUserKeyRelease()
 {
-    QMutexLocker lk(&audioMtx1_);
-    uint8_t ret = 0;
-    int vol = volume_;
-    if (vol < CEC::CEC_AUDIO_VOLUME_MIN)
-    {
-        vol = CEC::CEC_AUDIO_VOLUME_MIN;
-    }
-    if (vol > CEC::CEC_AUDIO_VOLUME_MAX)
+    bool ret = cec_adapter->SendKeyRelease(active_device());
+    traceKey(CEC::CEC_OPCODE_USER_CONTROL_RELEASE);
+    return ret;
+}
+
+bool CECAudio::sendCommand(CEC::cec_logical_address destination, CEC::cec_opcode opcode, const uint8_t *params, int size)
+{
+    //  Unknown destination means the active source
+    if (destination == CEC::CECDEVICE_UNKNOWN)
     {
-        vol = CEC::CEC_AUDIO_VOLUME_MAX;
+        destination = active_device();
     }
-    ret |= static_cast<uint8_t>(vol) & CEC::CEC_AUDIO_VOLUME_STATUS_MASK;
-    if (muted_)
+    CEC::cec_command command;
+    command.Format(command, CEC::CECDEVICE_AUDIOSYSTEM, destination, opcode);
+    for (int ii = 0; ii < size; ii++)
     {
-        ret |= CEC::CEC_AUDIO_MUTE_STATUS_MASK;
+        command.PushBack(params[ii]);
     }
+    bool ret = cec_adapter->Transmit(command);
+    trace_->record(CECTrace::Transmitted, command);
+    metrics_->cec_tx.add();
+    logResponse("sendCommand", command);
     return ret;
 }
 
-int CECAudio::sendAudioStatus(CEC::cec_logical_address destination)
+void CECAudio::audio_status_timeout()
+{
+    //  Tell the TV about changes made since the last report
+    sendAudioStatus(CEC::CECDEVICE_TV, true);
+}
+
+uint8_t CECAudio::audioStatus() const
 {
-    QMutexLocker lk(&audioMtx2_);
-    last_audio_status_ = audioStatus();
+    return audio_status_.load(std::memory_order_relaxed);
+}
+
+int CECAudio::sendAudioStatus(CEC::cec_logical_address destination, bool onlyIfChanged)
+{
+    //  Claim the report by swapping in the status being sent, so of a racing reply and
+    //  timer report only one goes out for the same status
+    uint8_t status = audioStatus();
+    int last = last_audio_status_.load(std::memory_order_relaxed);
+    do
+    {
+        if (onlyIfChanged && last == status)
+        {
+            return 0;
+        }
+    }
+    while (!last_audio_status_.compare_exchange_weak(last, status, std::memory_order_relaxed));
+
     CEC::cec_command response;
     response.Format(response, CEC::CECDEVICE_AUDIOSYSTEM, destination, CEC::CEC_OPCODE_REPORT_AUDIO_STATUS);
-    response.PushBack(last_audio_status_);
+    response.PushBack(status);
     int ret = cec_adapter->Transmit(response);
+    trace_->record(CECTrace::Transmitted, response);
+    metrics_->cec_tx.add();
     emit triggerVolumeTimer();
     logResponse("sendAudioStatus", response);
     return ret;
@@ -216,110 +473,234 @@ void CECAudio::commandReceived(const CEC::cec_command *command)
 
 int CECAudio::commandHandler(const CEC::cec_command *command)
 {
-    int ret = 0;
+    //  libcec waits for this to return before it acknowledges the next frame, so only
+    //  record and queue the frame here
+    Event event;
+    event.kind = Event::Command;
+    event.received = monotonicNs();
+    event.command = *command;
+    last_rx_ns_.store(event.received, std::memory_order_relaxed);
+    trace_->record(CECTrace::Received, *command);
+    metrics_->cec_rx.add();
+    bool queued = post(commands_, event);
+
+    //  We answer audio status requests ourselves; when the queue is full the
+    //  reply goes out from here, the status byte needs no Qt thread
+    if (command->opcode != CEC::CEC_OPCODE_GIVE_AUDIO_STATUS)
+    {
+        return 0;
+    }
+    if (!queued)
+    {
+        sendAudioStatus(command->initiator);
+    }
+    return 1;
+}
 
-    if (log_level() & CEC::CEC_LOG_NOTICE)
+bool CECAudio::post(SPSCQueue<Event, kEventSlots> &queue, const Event &event)
+{
+    if (queue.push(event))
+    {
+        sem_post(&worker_wake_);
+        return true;
+    }
+    metrics_->cec_queue_dropped.add();
+    return false;
+}
+
+void CECAudio::workerLoop()
+{
+    Event event;
+    while (true)
     {
-        std::cout << "***** commandHandler " << command->initiator << " " << command->destination << std::hex <<
-                     "  opcode=" << command->opcode << " (" << cec_adapter->ToString(command->opcode) << ")";
-        if (command->parameters.size > 0)
+        while (sem_wait(&worker_wake_) != 0)
         {
-            std::cout << " data[" << (uint)command->parameters.size << "]";
-            for (int ii = 0; ii < command->parameters.size; ii++)
+            //  EINTR
+        }
+        if (!worker_running_.load())
+        {
+            break;
+        }
+
+        uint32_t depth = queueDepth();
+        metrics_->cec_queue_depth.set(depth);
+        if (depth > queue_high_)
+        {
+            queue_high_ = depth;
+            metrics_->cec_queue_high.set(depth);
+            if (depth > 1)
+            {
+                CECLOG(log_, Health, Debug, "CEC event queue depth %u", depth);
+            }
+        }
+
+        //  Frames first; a key press is never ahead of the frame that carried it
+        if (commands_.pop(event) || events_.pop(event))
+        {
+            metrics_->cec_queue_wait.observe(monotonicNs() - event.received);
+            switch (event.kind)
             {
-                std::cout << " " << std::hex << (uint)command->parameters.data[ii];
+            case Event::Command:
+                processCommand(event.command);
+                break;
+
+            case Event::Keypress:
+                processKeypress(event.key);
+                break;
+
+            case Event::Source:
+                if (event.activated)
+                {
+                    setActive_device(event.source);
+                }
+                break;
             }
         }
-        std::cout << endl;
+    }
+}
+
+void CECAudio::stopWorker()
+{
+    if (worker_.joinable())
+    {
+        worker_running_.store(false);
+        sem_post(&worker_wake_);
+        worker_.join();
+    }
+}
+
+void CECAudio::processCommand(const CEC::cec_command &command)
+{
+    int64_t start = monotonicNs();
+    devices_.seen(command.initiator);
+
+    //  Frame dumps are at debug so Release builds, which compile trace out, still have them
+    if (CECLOG_ON(log_, CecRx, Debug))
+    {
+        char data[3 * CEC_MAX_DATA_PACKET_SIZE + 16];
+        formatParameters(command.parameters, data, sizeof(data));
+        log_->print(LogCategory::CecRx, "command %d -> %d opcode %#x (%s)%s", command.initiator, command.destination,
+                    command.opcode, cec_adapter->ToString(command.opcode), data);
     }
 
-    switch (command->opcode)
+    switch (command.opcode)
     {
     case CEC::CEC_OPCODE_REPORT_POWER_STATUS:
-        if (command->initiator == CEC::CECDEVICE_TV)
+        if (command.initiator == CEC::CECDEVICE_TV)
         {
-            setTv_power(static_cast<CEC::cec_power_status>(command->parameters.At(0)));
+            setTv_power(static_cast<CEC::cec_power_status>(command.parameters.At(0)));
         }
+        else
+        {
+            devices_.setPower(command.initiator, static_cast<CEC::cec_power_status>(command.parameters.At(0)));
+        }
+        break;
+
+    case CEC::CEC_OPCODE_SET_OSD_NAME:
+        devices_.setOSDName(command.initiator, std::string(reinterpret_cast<const char *>(command.parameters.data),
+                                                            command.parameters.size));
+        break;
+
+    case CEC::CEC_OPCODE_DEVICE_VENDOR_ID:
+        devices_.setVendor(command.initiator, (command.parameters.At(0) << 16) + (command.parameters.At(1) << 8) +
+                                               command.parameters.At(2));
         break;
 
     case CEC::CEC_OPCODE_STANDBY:
         setTv_power(CEC::CEC_POWER_STATUS_STANDBY);
         setActive_device(CEC::CECDEVICE_UNKNOWN);
+        //  Sources may give up their address while off; they report it again on wake up
+        for (int ii = CEC::CECDEVICE_RECORDINGDEVICE1; ii < CEC::CECDEVICE_BROADCAST; ii++)
+        {
+            if (ii != CEC::CECDEVICE_AUDIOSYSTEM)
+            {
+                topology_.remove(static_cast<CEC::cec_logical_address>(ii));
+            }
+        }
+        break;
+
+    case CEC::CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+        topology_.update(command.initiator, physicalFromParameters(command.parameters));
         break;
 
     case CEC::CEC_OPCODE_GIVE_DEVICE_POWER_STATUS:
-        if (command->initiator == CEC::CECDEVICE_TV && tv_power_ != CEC::CEC_POWER_STATUS_ON)
+        if (command.initiator == CEC::CECDEVICE_TV && tv_power() != CEC::CEC_POWER_STATUS_ON)
         {
-            CEC::cec_power_status tvpower = cec_adapter->GetDevicePowerStatus(CEC::CECDEVICE_TV);
-            setTv_power(tvpower);
+            devices_.requestRefresh(CEC::CECDEVICE_TV, CECDeviceCache::Power);
         }
         break;
 
     case::CEC::CEC_OPCODE_ACTIVE_SOURCE:
-        setActive_device(fromPhysical(physicalFromParameters(command->parameters)));
+        topology_.update(command.initiator, physicalFromParameters(command.parameters));
+        setActivePhysical(physicalFromParameters(command.parameters));
         break;
 
     case CEC::CEC_OPCODE_SET_STREAM_PATH:
-        setActive_device(fromPhysical(physicalFromParameters(command->parameters)));
+        setActivePhysical(physicalFromParameters(command.parameters));
         break;
 
     case CEC::CEC_OPCODE_ROUTING_CHANGE:
-        setActive_device(fromPhysical(physicalFromParameters(command->parameters, 2)));
+        setActivePhysical(physicalFromParameters(command.parameters, 2));
         break;
 
     case CEC::CEC_OPCODE_GIVE_AUDIO_STATUS:
-        ret = sendAudioStatus(command->initiator);
+        sendAudioStatus(command.initiator);
+        break;
+
+    case CEC::CEC_OPCODE_USER_CONTROL_PRESSED:
+        //  Here rather than in processKeypress so a status request that follows the key sees it
+        if (predict_step_.load(std::memory_order_relaxed) > 0 && command.destination == CEC::CECDEVICE_AUDIOSYSTEM)
+        {
+            predictVolume(static_cast<CEC::cec_user_control_code>(command.parameters.At(0)));
+        }
         break;
 
     default:
         break;
     }
 
-    return ret;
+    metrics_->handler[command.opcode & 0xff].observe(monotonicNs() - start);
 }
 
 void CECAudio::logMessage(const CEC::cec_log_message *message)
 {
     if (message->level & log_level_)
     {
-        std::cout << "Message (mask=" << std::hex << message->level << ")" << endl;
-        std::cout << message->message << endl;
+        CECLOG(log_, Libcec, Info, "(%#x) %s", message->level, message->message);
     }
 }
 
 void CECAudio::on_keypress(const CEC::cec_keypress *msg)
 {
-    if (log_level_ & CEC::CEC_LOG_DEBUG)
-    {
-        std::cout << endl << "***** on_keypress: " << std::hex << msg->keycode << " duration " << std::dec << msg->duration << endl;
-    }
+    Event event;
+    event.kind = Event::Keypress;
+    event.received = monotonicNs();
+    event.key = *msg;
+    last_rx_ns_.store(event.received, std::memory_order_relaxed);
+    post(events_, event);
+}
 
-    switch (msg->keycode)
+void CECAudio::processKeypress(const CEC::cec_keypress &key)
+{
+    CECLOG(log_, CecRx, Debug, "keypress %#x duration %u", key.keycode, key.duration);
+
+    switch (key.keycode)
     {
     case CEC::CEC_USER_CONTROL_CODE_VOLUME_UP:
-        emit volumeUp(msg->duration == 0);
-        if (log_level_ & CEC::CEC_LOG_DEBUG)
-        {
-            std::cout << "!!!!! volume up " << (msg->duration == 0 ? "pressed" : "released") << endl;
-        }
+        emit volumeUp(key.duration == 0);
+        CECLOG(log_, Volume, Trace, "volume up %s", key.duration == 0 ? "pressed" : "released");
         break;
 
     case CEC::CEC_USER_CONTROL_CODE_VOLUME_DOWN:
-        emit volumeDown(msg->duration == 0);
-        if (log_level_ & CEC::CEC_LOG_DEBUG)
-        {
-            std::cout << "!!!!! volume down " << (msg->duration == 0 ? "pressed" : "released") << endl;
-        }
+        emit volumeDown(key.duration == 0);
+        CECLOG(log_, Volume, Trace, "volume down %s", key.duration == 0 ? "pressed" : "released");
         break;
 
     case CEC::CEC_USER_CONTROL_CODE_MUTE:
-        if (msg->duration == 0)
+        if (key.duration == 0)
         {
             emit toggleMute();
-            if (log_level_ & CEC::CEC_LOG_DEBUG)
-            {
-                std::cout << "!!!!! toggle mute" << endl;
-            }
+            CECLOG(log_, Volume, Trace, "toggle mute");
         }
         break;
 
@@ -330,42 +711,97 @@ void CECAudio::on_keypress(const CEC::cec_keypress *msg)
 
 void CECAudio::configurationChanged(const CEC::libcec_configuration* configuration)
 {
-    if (log_level_ & CEC::CEC_LOG_DEBUG)
-    {
-        std::cout << endl << "  *****  Configuration changed  *****" << endl;
-    }
+    CECLOG(log_, CecRx, Trace, "Configuration changed");
+    //  Our physical address may have moved (hotplug)
+    requestTopologyScan();
 }
 
 void CECAudio::do_alert(const CEC::libcec_alert alert, const CEC::libcec_parameter param)
 {
-    std::cout << endl << "  ***** Alert!!!  *****" << endl;
+    CECLOG(log_, CecRx, Warn, "Alert %d", alert);
+    if (alert == CEC::CEC_ALERT_CONNECTION_LOST || alert == CEC::CEC_ALERT_PHYSICAL_ADDRESS_ERROR)
+    {
+        topology_.clear();
+        requestTopologyScan();
+    }
 }
 
 void CECAudio::sourceActivated(const CEC::cec_logical_address logicalAddress, const uint8_t bActivated)
 {
-    if (log_level_ & CEC::CEC_LOG_DEBUG)
+    CECLOG(log_, CecRx, Trace, "Source %d %s", logicalAddress, bActivated ? "activated" : "deactivated");
+    Event event;
+    event.kind = Event::Source;
+    event.received = monotonicNs();
+    event.source = logicalAddress;
+    event.activated = bActivated != 0;
+    post(events_, event);
+}
+
+CEC::cec_logical_address CECAudio::fromPhysical(uint16_t physical)
+{
+    return topology_.lookup(physical);
+}
+
+void CECAudio::setActivePhysical(uint16_t physical)
+{
+    CEC::cec_logical_address logaddr = fromPhysical(physical);
+    if (logaddr != CEC::CECDEVICE_UNKNOWN)
     {
-        std::cout << endl << "###### Source " << logicalAddress << (bActivated ? " activated " : " deactivated") << endl;
+        setActive_device(logaddr);
     }
-    if (bActivated)
+    else if (topology_.recentlyMissing(physical, monotonicMs(), kMissingRescanMs))
     {
-        setActive_device(logicalAddress);
+        //  An input without a CEC device; a device that appears there reports its address
+        CECLOG(log_, CecRx, Debug, "Active physical %04x not on the bus", physical);
+    }
+    else
+    {
+        //  Not in the map: resolve after a scan rather than polling here
+        pending_physical_ = physical;
+        requestTopologyScan();
     }
 }
 
-CEC::cec_logical_address CECAudio::fromPhysical(uint16_t physical)
+void CECAudio::requestTopologyScan()
+{
+    //  Scans run on the discovery thread
+    if (!scan_requested_.exchange(true))
+    {
+        sem_post(&scan_wake_);
+    }
+}
+
+void CECAudio::scanTopology()
 {
-    CEC::cec_logical_address ret = CEC::CECDEVICE_UNKNOWN;
-    for (int ii = 0; ii < 15; ii++)
+    scan_requested_ = false;
+    CEC::cec_logical_addresses active = cec_adapter->GetActiveDevices();
+    for (int ii = CEC::CECDEVICE_TV; ii < CEC::CECDEVICE_BROADCAST; ii++)
     {
         CEC::cec_logical_address logaddr = static_cast<CEC::cec_logical_address>(ii);
-        if (cec_adapter->GetDevicePhysicalAddress(logaddr) == physical)
+        if (active.IsSet(logaddr))
         {
-            ret = logaddr;
-            break;
+            topology_.update(logaddr, cec_adapter->GetDevicePhysicalAddress(logaddr));
+        }
+        else
+        {
+            topology_.remove(logaddr);
+        }
+    }
+    CECLOG(log_, General, Info, "Topology scan found %d devices", topology_.size());
+
+    int pending = pending_physical_.exchange(-1);
+    if (pending >= 0)
+    {
+        CEC::cec_logical_address logaddr = topology_.lookup(pending);
+        if (logaddr != CEC::CECDEVICE_UNKNOWN)
+        {
+            setActive_device(logaddr);
+        }
+        else
+        {
+            topology_.markMissing(pending, monotonicMs());
         }
     }
-    return ret;
 }
 
 uint16_t CECAudio::physicalFromParameters(const CEC::cec_datapacket &parameters, int offset) const
@@ -375,18 +811,56 @@ uint16_t CECAudio::physicalFromParameters(const CEC::cec_datapacket &parameters,
 
 void CECAudio::logResponse(const char *label, const CEC::cec_command &response)
 {
-    if ((log_level() & CEC::CEC_LOG_NOTICE) != 0)
+    if (CECLOG_ON(log_, CecRx, Debug))
+    {
+        char data[3 * CEC_MAX_DATA_PACKET_SIZE + 16];
+        formatParameters(response.parameters, data, sizeof(data));
+        log_->print(LogCategory::CecRx, "%s response %d -> %d opcode %#x (%s)%s", label, response.initiator,
+                    response.destination, response.opcode, cec_adapter->ToString(response.opcode), data);
+    }
+}
+
+void CECAudio::formatParameters(const CEC::cec_datapacket &parameters, char *buf, size_t size)
+{
+    buf[0] = 0;
+    if (parameters.size > 0)
+    {
+        int len = snprintf(buf, size, " data[%u]", parameters.size);
+        for (int ii = 0; ii < parameters.size && len > 0 && static_cast<size_t>(len) < size; ii++)
+        {
+            len += snprintf(buf + len, size - len, " %02x", parameters.data[ii]);
+        }
+    }
+}
+
+void CECAudio::deviceUpdated(CEC::cec_logical_address addr, CECDeviceCache::Field field)
+{
+    //  Called on the thread that updated the cache; the active device is compared on the Qt thread that sets it
+    if (field == CECDeviceCache::Power && addr == CEC::CECDEVICE_TV)
+    {
+        setTv_power(devices_.power(addr));
+    }
+    else if (field == CECDeviceCache::Name)
     {
-        std::cout << "***** " << label << " response ***** from " << response.initiator << " to " << response.destination << std::hex <<
-                     "  opcode=" << response.opcode << " (" << cec_adapter->ToString(response.opcode) << ")";
-        if (response.parameters.size > 0)
+        QMetaObject::invokeMethod(this, [this, addr]()
         {
-            std::cout << " data[" << (uint)response.parameters.size << "]";
-            for (int ii = 0; ii < response.parameters.size; ii++)
+            if (addr == active_device())
             {
-                std::cout << " " << std::hex << (uint)response.parameters.data[ii];
+                emit active_deviceChanged(addr, devices_.osdName(addr));
             }
-        }
-        std::cout << endl;
+        }, Qt::QueuedConnection);
+    }
+}
+
+void CECAudio::traceKey(CEC::cec_opcode opcode, CEC::cec_user_control_code key)
+{
+    //  SendKeypress/SendKeyRelease build the frame inside libcec so record its equivalent
+    CEC::cec_command command;
+    command.Format(command, CEC::CECDEVICE_AUDIOSYSTEM, active_device(), opcode);
+    if (key != CEC::CEC_USER_CONTROL_CODE_UNKNOWN)
+    {
+        command.PushBack(static_cast<uint8_t>(key));
     }
+    trace_->record(CECTrace::Transmitted, command);
+    metrics_->cec_tx.add();
 }
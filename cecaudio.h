@@ -2,37 +2,97 @@
 #define CECAUDIO_H
 
 #include <QObject>
-#include <QMutex>
 #include <QTimer>
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
 #include <libcec/cec.h>
+#include "cecadapter.h"
+#include "cecdevices.h"
+#include "cectopology.h"
+#include "spscqueue.h"
 
 class CECLog;
+class CECTrace;
+struct Metrics;
 
 class CECAudio : public QObject
 {
     Q_OBJECT
+    friend class TVCECBench;
 
 private:
-    CEC::ICECAdapter            *cec_adapter;
+    CECAdapter                  *cec_adapter;
     CEC::ICECCallbacks          cec_callbacks;
     CEC::libcec_configuration   cec_config;
 
-    CEC::cec_power_status       tv_power_;
-    CEC::cec_logical_address    active_device_;
-    CEC::cec_log_level          log_level_;
+    //  Read from any thread but written on the Qt thread only; the setters pass
+    //  changes made on other threads over to it
+    std::atomic<CEC::cec_power_status> tv_power_;
+    std::atomic<CEC::cec_logical_address> active_device_;
+    std::atomic<CEC::cec_log_level> log_level_;         // Set from the Qt thread, read by the libcec threads
 
-    int                         volume_;
-    bool                        muted_;
+    //  Audio state is the packed CEC audio status byte (volume | mute bit) so the
+    //  reply path reads it with one load and never waits for the Qt thread
+    std::atomic<uint8_t>        audio_status_;          // Current status
+    std::atomic<int>            last_audio_status_;     // Last status transmitted or -1
+    std::atomic<int>            predict_step_;          // Volume change per key press when predicting, 0 off
 
     QTimer                      *audio_timer_;
-    uint8_t                     last_audio_status_;
-    mutable QMutex              audioMtx1_;
-    mutable QMutex              audioMtx2_;
 
     CECLog                      *log_;
+    CECTrace                    *trace_;
+    Metrics                     *metrics_;
+    std::atomic<int64_t>        last_rx_ns_;            // Monotonic time of the last received frame
+
+    CECTopology                 topology_;              // Physical to logical address map
+    CECDeviceCache              devices_;               // Per logical address device state
+    std::atomic<int>            pending_physical_;      // Unresolved active physical address or -1
+    std::atomic<bool>           scan_requested_;        // Topology scan queued
+    std::atomic<bool>           active_restored_;       // Active source is from the state file, not yet seen
+
+    std::string                 adapter_cache_;         // File holding the last adapter port, empty for none
+    std::string                 port_;                  // Adapter port to open, empty to detect
+    std::thread                 discovery_;             // Startup bus state discovery, then topology scans
+    std::atomic<bool>           discovery_running_;     // Discovery thread run flag
+    sem_t                       scan_wake_;             // Posted when a topology scan is requested
+    static const int64_t        kMissingRescanMs = 60000;   // Rescan for an address a scan did not find after
+
+    //  libcec callbacks only copy the event into a queue; the worker thread does the rest
+    struct Event
+    {
+        enum Kind : uint8_t
+        {
+            Command,
+            Keypress,
+            Source
+        };
+        Kind                        kind;
+        int64_t                     received;           // Monotonic nsec at callback
+        CEC::cec_command            command;            // Command
+        CEC::cec_keypress           key;                // Keypress
+        CEC::cec_logical_address    source;             // Source
+        bool                        activated;          // Source
+    };
+    static const uint32_t       kEventSlots = 128;
+    SPSCQueue<Event, kEventSlots> commands_;            // From commandHandler (libcec processor thread)
+    SPSCQueue<Event, kEventSlots> events_;              // From keyPress and sourceActivated (libcec callback thread)
+    std::thread                 worker_;                // Event worker
+    std::atomic<bool>           worker_running_;        // Worker run flag
+    sem_t                       worker_wake_;           // Posted once per queued event
+    uint32_t                    queue_high_;            // Deepest backlog seen (worker)
+
+    bool post(SPSCQueue<Event, kEventSlots> &queue, const Event &event);
+    void workerLoop();
+    void stopWorker();
+    bool openAdapter();
+    void discoverBus();
+    void processCommand(const CEC::cec_command &command);
+    void processKeypress(const CEC::cec_keypress &key);
+    void predictVolume(CEC::cec_user_control_code key);
 
     uint8_t audioStatus() const;
-    int sendAudioStatus(CEC::cec_logical_address destination=CEC::CECDEVICE_TV);
+    int sendAudioStatus(CEC::cec_logical_address destination=CEC::CECDEVICE_TV, bool onlyIfChanged=false);
 
     void commandReceived(const CEC::cec_command* command);
     static void commandReceived(void* cbparam, const CEC::cec_command* command)
@@ -63,19 +123,38 @@ private:
             {static_cast<CECAudio *>(cbparam)->sourceActivated(logicalAddress, bActivated);}
 
     CEC::cec_logical_address fromPhysical(uint16_t physical);
+    void setActivePhysical(uint16_t physical);
+    void requestTopologyScan();
+    void scanTopology();
     uint16_t physicalFromParameters(const CEC::cec_datapacket &parameters, int offset = 0) const;
 
     void logResponse(const char *label, const CEC::cec_command &response);
+    static void formatParameters(const CEC::cec_datapacket &parameters, char *buf, size_t size);
+    void deviceUpdated(CEC::cec_logical_address addr, CECDeviceCache::Field field);
+    void traceKey(CEC::cec_opcode opcode, CEC::cec_user_control_code key = CEC::CEC_USER_CONTROL_CODE_UNKNOWN);
 
 public:
-    CECAudio(CECLog *logger);
+    CECAudio(CECLog *logger, CECTrace *trace, Metrics *metrics);
     virtual ~CECAudio();
 
+    void setAdapter(CECAdapter *adapter);
+    void setAdapterCache(const char *filename) {adapter_cache_ = filename ? filename : "";}
+    void setPort(const std::string &port) {port_ = port;}
+    const std::string &port() const {return port_;}
+    void setVolumePrediction(int step) {predict_step_.store(step < 0 ? 0 : step);}
+    void setAudioStatusDelay(int msec) {audio_timer_->setInterval(msec);}
+    void restore(CEC::cec_power_status power, CEC::cec_logical_address active, const std::string &osdname,
+                 const uint16_t *physical);
     bool init();
 
-    CEC::cec_power_status getTVPower() const {return cec_adapter->GetDevicePowerStatus(CEC::CECDEVICE_TV);}
-    CEC::cec_logical_address getActiveAddress() const {return cec_adapter->GetActiveSource();}
-    std::string getActiveName() const {return cec_adapter->GetDeviceOSDName(active_device_);}
+    //  Cached state; these never block on the bus. Ages are in ms (-1 never seen)
+    CEC::cec_power_status getTVPower(int64_t *ageMs = nullptr) const {return devices_.power(CEC::CECDEVICE_TV, ageMs);}
+    CEC::cec_logical_address getActiveAddress() const {return active_device();}
+    std::string getActiveName(int64_t *ageMs = nullptr) const {return devices_.osdName(active_device(), ageMs);}
+    CECDeviceState deviceState(CEC::cec_logical_address addr) const {return devices_.state(addr);}
+    const CECTopology &topology() const {return topology_;}
+    int64_t lastRxNs() const {return last_rx_ns_.load(std::memory_order_relaxed);}
+    uint32_t queueDepth() const {return commands_.size() + events_.size();}
 
 public slots:
     CEC::cec_power_status tv_power() const;
@@ -87,9 +166,11 @@ public slots:
 
     void setVolume(int volume);
     void setMuted(bool muted);
+    void reportAudioStatus();
 
-    void sendUserKeyPress(CEC::cec_user_control_code key, int releaseDelay=100);
-    void sendUserKeyRelease();
+    bool sendUserKeyPress(CEC::cec_user_control_code key, int releaseDelay=100);
+    bool sendUserKeyRelease();
+    bool sendCommand(CEC::cec_logical_address destination, CEC::cec_opcode opcode, const uint8_t *params, int size);
 
 signals:
     void tv_powerChanged(CEC::cec_power_status power);
@@ -98,6 +179,7 @@ signals:
     void volumeDown(bool pressed);
     void toggleMute();
     void triggerVolumeTimer();
+    void audioStatusChanged(int volume, bool muted);
 
 private slots:
     void audio_status_timeout();
@@ -0,0 +1,273 @@
+#include "cecdevices.h"
+#include "cecadapter.h"
+#include <time.h>
+#include <chrono>
+
+CECDeviceCache::CECDeviceCache() : adapter_(nullptr), running_(false), pending_(false), power_stale_(30000), name_stale_(600000)
+{
+    for (int ii = 0; ii < 16; ii++)
+    {
+        Entry &ent = entries_[ii];
+        ent.power = CEC::CEC_POWER_STATUS_UNKNOWN;
+        ent.vendor = 0;
+        ent.power_time = ent.name_time = ent.vendor_time = ent.seen_time = 0;
+        ent.tracked = 0;
+        ent.requested = 0;
+    }
+}
+
+CECDeviceCache::~CECDeviceCache()
+{
+    stop();
+}
+
+int64_t CECDeviceCache::nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + 1;
+}
+
+void CECDeviceCache::start(CECAdapter *adapter)
+{
+    stop();
+    adapter_ = adapter;
+    running_ = true;
+    refresher_ = std::thread(&CECDeviceCache::refreshLoop, this);
+}
+
+void CECDeviceCache::stop()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    if (refresher_.joinable())
+    {
+        refresher_.join();
+    }
+}
+
+void CECDeviceCache::setStaleTimes(int64_t powerMs, int64_t nameMs)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    power_stale_ = powerMs;
+    name_stale_ = nameMs;
+}
+
+void CECDeviceCache::seen(CEC::cec_logical_address addr)
+{
+    if (valid(addr))
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        entries_[addr].seen_time = nowMs();
+    }
+}
+
+void CECDeviceCache::setPower(CEC::cec_logical_address addr, CEC::cec_power_status power)
+{
+    if (!valid(addr))
+    {
+        return;
+    }
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        Entry &ent = entries_[addr];
+        changed = ent.power != power;
+        ent.power = power;
+        ent.power_time = ent.seen_time = nowMs();
+        ent.requested &= ~Power;
+    }
+    if (changed)
+    {
+        notify(addr, Power);
+    }
+}
+
+void CECDeviceCache::setOSDName(CEC::cec_logical_address addr, const std::string &name)
+{
+    if (!valid(addr))
+    {
+        return;
+    }
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        Entry &ent = entries_[addr];
+        changed = ent.osd_name != name;
+        ent.osd_name = name;
+        ent.name_time = ent.seen_time = nowMs();
+        ent.requested &= ~Name;
+    }
+    if (changed)
+    {
+        notify(addr, Name);
+    }
+}
+
+void CECDeviceCache::setVendor(CEC::cec_logical_address addr, uint32_t vendor)
+{
+    if (!valid(addr))
+    {
+        return;
+    }
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        Entry &ent = entries_[addr];
+        changed = ent.vendor != vendor;
+        ent.vendor = vendor;
+        ent.vendor_time = ent.seen_time = nowMs();
+        ent.requested &= ~Vendor;
+    }
+    if (changed)
+    {
+        notify(addr, Vendor);
+    }
+}
+
+void CECDeviceCache::track(CEC::cec_logical_address addr, uint8_t fields)
+{
+    if (valid(addr))
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        entries_[addr].tracked |= fields;
+    }
+}
+
+void CECDeviceCache::requestRefresh(CEC::cec_logical_address addr, uint8_t fields)
+{
+    if (!valid(addr))
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        entries_[addr].requested |= fields;
+        pending_ = true;
+    }
+    wake_.notify_one();
+}
+
+CECDeviceState CECDeviceCache::state(CEC::cec_logical_address addr) const
+{
+    CECDeviceState ret;
+    ret.power = CEC::CEC_POWER_STATUS_UNKNOWN;
+    ret.vendor = 0;
+    ret.power_age = ret.name_age = ret.vendor_age = ret.seen_age = -1;
+    if (valid(addr))
+    {
+        int64_t now = nowMs();
+        std::lock_guard<std::mutex> lk(mtx_);
+        const Entry &ent = entries_[addr];
+        ret.power = ent.power;
+        ret.osd_name = ent.osd_name;
+        ret.vendor = ent.vendor;
+        ret.power_age = age(ent.power_time, now);
+        ret.name_age = age(ent.name_time, now);
+        ret.vendor_age = age(ent.vendor_time, now);
+        ret.seen_age = age(ent.seen_time, now);
+    }
+    return ret;
+}
+
+CEC::cec_power_status CECDeviceCache::power(CEC::cec_logical_address addr, int64_t *ageMs) const
+{
+    CEC::cec_power_status ret = CEC::CEC_POWER_STATUS_UNKNOWN;
+    int64_t ret_age = -1;
+    if (valid(addr))
+    {
+        int64_t now = nowMs();
+        std::lock_guard<std::mutex> lk(mtx_);
+        ret = entries_[addr].power;
+        ret_age = age(entries_[addr].power_time, now);
+    }
+    if (ageMs)
+    {
+        *ageMs = ret_age;
+    }
+    return ret;
+}
+
+std::string CECDeviceCache::osdName(CEC::cec_logical_address addr, int64_t *ageMs) const
+{
+    std::string ret;
+    int64_t ret_age = -1;
+    if (valid(addr))
+    {
+        int64_t now = nowMs();
+        std::lock_guard<std::mutex> lk(mtx_);
+        ret = entries_[addr].osd_name;
+        ret_age = age(entries_[addr].name_time, now);
+    }
+    if (ageMs)
+    {
+        *ageMs = ret_age;
+    }
+    return ret;
+}
+
+void CECDeviceCache::notify(CEC::cec_logical_address addr, Field field)
+{
+    if (listener_)
+    {
+        listener_(addr, field);
+    }
+}
+
+void CECDeviceCache::refreshLoop()
+{
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (running_)
+    {
+        wake_.wait_for(lk, std::chrono::seconds(1), [this] {return pending_ || !running_;});
+        if (!running_)
+        {
+            break;
+        }
+        pending_ = false;
+
+        //  Collect what is due, then query the bus without holding the lock
+        uint8_t due[16];
+        int64_t now = nowMs();
+        for (int ii = 0; ii < 16; ii++)
+        {
+            Entry &ent = entries_[ii];
+            due[ii] = ent.requested;
+            if ((ent.tracked & Power) && (ent.power_time == 0 || now - ent.power_time > power_stale_))
+            {
+                due[ii] |= Power;
+            }
+            if ((ent.tracked & Name) && (ent.name_time == 0 || now - ent.name_time > name_stale_))
+            {
+                due[ii] |= Name;
+            }
+            if ((ent.tracked & Vendor) && (ent.vendor_time == 0 || now - ent.vendor_time > name_stale_))
+            {
+                due[ii] |= Vendor;
+            }
+            ent.requested = 0;
+        }
+
+        lk.unlock();
+        for (int ii = 0; ii < 16 && adapter_; ii++)
+        {
+            CEC::cec_logical_address addr = static_cast<CEC::cec_logical_address>(ii);
+            if (due[ii] & Power)
+            {
+                setPower(addr, adapter_->GetDevicePowerStatus(addr));
+            }
+            if (due[ii] & Name)
+            {
+                setOSDName(addr, adapter_->GetDeviceOSDName(addr));
+            }
+            if (due[ii] & Vendor)
+            {
+                setVendor(addr, adapter_->GetDeviceVendorId(addr));
+            }
+        }
+        lk.lock();
+    }
+}
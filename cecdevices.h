@@ -0,0 +1,102 @@
+#ifndef CECDEVICES_H
+#define CECDEVICES_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <libcec/cec.h>
+
+class CECAdapter;
+
+//  Snapshot of what is known about one logical address. Ages are in
+//  milliseconds since the value was last observed, or -1 if never.
+struct CECDeviceState
+{
+    CEC::cec_power_status   power;
+    std::string             osd_name;
+    uint32_t                vendor;
+    int64_t                 power_age;
+    int64_t                 name_age;
+    int64_t                 vendor_age;
+    int64_t                 seen_age;
+};
+
+//  Per logical address device state cache
+//
+//  Updated from observed CEC traffic; a background thread refreshes stale or
+//  requested entries from the adapter so that getters never block on the bus.
+class CECDeviceCache
+{
+public:
+    enum Field
+    {
+        Power   = 0x01,
+        Name    = 0x02,
+        Vendor  = 0x04
+    };
+
+    typedef std::function<void(CEC::cec_logical_address, Field)> Listener;
+
+private:
+    struct Entry
+    {
+        CEC::cec_power_status   power;
+        std::string             osd_name;
+        uint32_t                vendor;
+        int64_t                 power_time;     // Monotonic ms of last update (0 never)
+        int64_t                 name_time;
+        int64_t                 vendor_time;
+        int64_t                 seen_time;
+        uint8_t                 tracked;        // Fields kept fresh in the background
+        uint8_t                 requested;      // Fields to refresh now
+    };
+
+    CECAdapter                  *adapter_;      // Adapter used for refreshes
+    Entry                       entries_[16];
+    mutable std::mutex          mtx_;
+    std::condition_variable     wake_;
+    std::thread                 refresher_;
+    bool                        running_;
+    bool                        pending_;       // Refresh requested
+    Listener                    listener_;
+
+    int64_t                     power_stale_;   // Refresh tracked power after (ms)
+    int64_t                     name_stale_;    // Refresh tracked names/vendor after (ms)
+
+    static int64_t nowMs();
+    static int64_t age(int64_t time, int64_t now) { return time ? now - time : -1; }
+    static bool valid(CEC::cec_logical_address addr) { return addr >= CEC::CECDEVICE_TV && addr < CEC::CECDEVICE_BROADCAST; }
+
+    void refreshLoop();
+    void notify(CEC::cec_logical_address addr, Field field);
+
+public:
+    CECDeviceCache();
+    ~CECDeviceCache();
+
+    void start(CECAdapter *adapter);
+    void stop();
+    void setListener(const Listener &listener) { listener_ = listener; }
+    void setStaleTimes(int64_t powerMs, int64_t nameMs);
+
+    //  Updates from observed traffic
+    void seen(CEC::cec_logical_address addr);
+    void setPower(CEC::cec_logical_address addr, CEC::cec_power_status power);
+    void setOSDName(CEC::cec_logical_address addr, const std::string &name);
+    void setVendor(CEC::cec_logical_address addr, uint32_t vendor);
+
+    //  Background refresh control
+    void track(CEC::cec_logical_address addr, uint8_t fields);
+    void requestRefresh(CEC::cec_logical_address addr, uint8_t fields);
+
+    //  Non-blocking getters
+    CECDeviceState state(CEC::cec_logical_address addr) const;
+    CEC::cec_power_status power(CEC::cec_logical_address addr, int64_t *ageMs = nullptr) const;
+    std::string osdName(CEC::cec_logical_address addr, int64_t *ageMs = nullptr) const;
+};
+
+#endif // CECDEVICES_H
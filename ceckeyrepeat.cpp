@@ -0,0 +1,111 @@
+#include "ceckeyrepeat.h"
+#include "cecaudio.h"
+#include "ceclog.h"
+#include "metrics.h"
+#include "monotonic.h"
+
+CECKeyRepeat::CECKeyRepeat(CECAudio *cec, CECLog *log, Metrics *metrics, QObject *parent) : QObject{parent}, cec_(cec),
+    log_(log), metrics_(metrics), interval_(400), key_(CEC::CEC_USER_CONTROL_CODE_UNKNOWN), held_(false), due_(0),
+    repeats_(0)
+{
+    repeat_timer_ = new QTimer(this);
+    repeat_timer_->setSingleShot(true);
+    repeat_timer_->setTimerType(Qt::PreciseTimer);
+    connect(repeat_timer_, &QTimer::timeout, this, &CECKeyRepeat::repeat);
+
+    watchdog_ = new QTimer(this);
+    watchdog_->setSingleShot(true);
+    watchdog_->setInterval(1000);
+    connect(watchdog_, &QTimer::timeout, this, &CECKeyRepeat::watchdogExpired);
+}
+
+void CECKeyRepeat::setInterval(int msec)
+{
+    interval_ = qBound(kMinInterval, msec, kMaxInterval);
+}
+
+bool CECKeyRepeat::press(CEC::cec_user_control_code key)
+{
+    //  A press of the key already held only refreshes the watchdog
+    if (held_ && key == key_)
+    {
+        touch();
+        return true;
+    }
+    if (held_)
+    {
+        release();
+    }
+    if (!cec_->sendUserKeyPress(key, 0))
+    {
+        CECLOG(log_, CecTx, Warn, "Key %d press not sent", key);
+        return false;
+    }
+    key_ = key;
+    held_ = true;
+    repeats_ = 0;
+    due_ = monotonicNs();
+    schedule();
+    watchdog_->start();
+    return true;
+}
+
+void CECKeyRepeat::release()
+{
+    if (!held_)
+    {
+        return;
+    }
+    repeat_timer_->stop();
+    watchdog_->stop();
+    held_ = false;
+    cec_->sendUserKeyRelease();
+    CECLOG(log_, CecTx, Debug, "Key %d released after %d repeats", key_, repeats_);
+}
+
+void CECKeyRepeat::touch()
+{
+    if (held_)
+    {
+        watchdog_->start();
+    }
+}
+
+void CECKeyRepeat::schedule()
+{
+    //  Absolute deadlines keep the average rate exact; after a stall skip the
+    //  missed repeats rather than sending them back to back
+    int64_t now = monotonicNs();
+    due_ += static_cast<int64_t>(interval_) * 1000000;
+    if (due_ < now)
+    {
+        due_ = now + static_cast<int64_t>(interval_) * 1000000;
+    }
+    repeat_timer_->start(static_cast<int>((due_ - now + 999999) / 1000000));
+}
+
+void CECKeyRepeat::repeat()
+{
+    if (!held_)
+    {
+        return;
+    }
+    int64_t late = monotonicNs() - due_;
+    metrics_->key_repeat_jitter.observe(late < 0 ? -late : late);
+    metrics_->key_repeats.add();
+    repeats_++;
+    cec_->sendUserKeyPress(key_, 0);
+    schedule();
+}
+
+void CECKeyRepeat::watchdogExpired()
+{
+    if (held_)
+    {
+        CECLOG(log_, CecTx, Warn, "Key %d held with no word from the remote, releasing", key_);
+        metrics_->key_forced_release.add();
+        CEC::cec_user_control_code key = key_;
+        release();
+        emit forcedRelease(key);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CECKEYREPEAT_H
+#define CECKEYREPEAT_H
+
+#include <QObject>
+#include <QTimer>
+#include <libcec/cec.h>
+
+class CECAudio;
+class CECLog;
+struct Metrics;
+
+//  Held keys toward CEC devices
+//
+//  While a remote holds a key, USER_CONTROL_PRESSED is repeated on a precise
+//  timer at the CEC repeat interval (200 to 450 msec; followers treat a gap
+//  over 550 msec as a release). Repeats are scheduled on absolute deadlines and
+//  their lateness goes to the key_repeat_jitter histogram. The remote keeps the
+//  hold alive by staying in touch; if it goes quiet for the watchdog time the
+//  key is released as if the remote had released it.
+class CECKeyRepeat : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int    kMinInterval = 200;     // CEC repeat interval bounds (msec)
+    static const int    kMaxInterval = 450;
+
+private:
+    CECAudio                    *cec_;          // Sends the key frames
+    CECLog                      *log_;          // Logger
+    Metrics                     *metrics_;      // Repeat jitter and counters
+    QTimer                      *repeat_timer_; // Next repeat
+    QTimer                      *watchdog_;     // Remote silence limit
+    int                         interval_;      // Repeat interval (msec)
+    CEC::cec_user_control_code  key_;           // Held key
+    bool                        held_;          // A key is held
+    int64_t                     due_;           // Monotonic nsec the next repeat is due
+    int                         repeats_;       // Repeats sent for the held key
+
+    void schedule();
+
+public:
+    CECKeyRepeat(CECAudio *cec, CECLog *log, Metrics *metrics, QObject *parent = nullptr);
+
+    void setInterval(int msec);
+    int interval() const {return interval_;}
+    void setWatchdog(int msec) {watchdog_->setInterval(msec);}
+    bool held() const {return held_;}
+    CECAudio *cec() const {return cec_;}
+    void setCEC(CECAudio *cec) {if (cec != cec_) {release(); cec_ = cec;}}
+
+public slots:
+    bool press(CEC::cec_user_control_code key);
+    void release();
+    void touch();
+
+private slots:
+    void repeat();
+    void watchdogExpired();
+
+signals:
+    void forcedRelease(CEC::cec_user_control_code key);
+};
+
+#endif // CECKEYREPEAT_H
@@ -1,16 +1,44 @@
 #include "ceclog.h"
 
+#include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
 
-CECLog::CECLog() : log_mask_(0xff), log_file_(nullptr)
-{
+static const char *const kCategoryNames[] = {"general", "libcec", "cec.rx", "cec.tx", "ws", "volume", "health"};
+static const char *const kLevelNames[] = {"error", "warn", "info", "debug", "trace"};
 
+CECLog::CECLog() : log_mask_(0xff), trace_(false), log_file_(nullptr), head_(0), tail_(0), dropped_(0), running_(true),
+    fd_(-1), file_size_(0), max_file_size_(1024 * 1024), max_total_size_(4 * 1024 * 1024)
+{
+    ring_ = new Slot[kSlots];
+    for (uint32_t ii = 0; ii < kSlots; ii++)
+    {
+        ring_[ii].seq.store(ii, std::memory_order_relaxed);
+        ring_[ii].len = 0;
+    }
+    applyMask();
+    writer_ = std::thread(&CECLog::writerLoop, this);
 }
 
 CECLog::~CECLog()
 {
+    running_.store(false);
+    wake_.notify_one();
+    if (writer_.joinable())
+    {
+        writer_.join();
+    }
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+    delete[] ring_;
     if (log_file_)
     {
         delete[] log_file_;
@@ -19,11 +47,17 @@ CECLog::~CECLog()
 
 void CECLog::setLogFile(const char *filename)
 {
+    std::lock_guard<std::mutex> lk(fileMtx_);
     if (log_file_)
     {
         delete [] log_file_;
         log_file_ = nullptr;
     }
+    if (fd_ >= 0)
+    {
+        close(fd_);
+        fd_ = -1;
+    }
     if (filename)
     {
         int n = strlen(filename);
@@ -31,48 +65,268 @@ void CECLog::setLogFile(const char *filename)
         {
             log_file_ = new char[n + 1];
             strncpy(log_file_, filename, n + 1);
+            openLogFile();
         }
     }
 }
 
-void CECLog::print(const char *format, va_list ap)
+void CECLog::setRotation(size_t maxFileSize, size_t maxTotalSize)
 {
-    time_t  now;
-    time(&now);
-    char timbuf[32];
-    strftime(timbuf, sizeof(timbuf), "%m/%d %H:%M:%S", localtime(&now));
-    if (log_file_)
+    std::lock_guard<std::mutex> lk(fileMtx_);
+    if (maxFileSize > 0)
+    {
+        max_file_size_ = maxFileSize;
+    }
+    max_total_size_ = maxTotalSize < max_file_size_ ? max_file_size_ : maxTotalSize;
+}
+
+void CECLog::setMask(const uint16_t &mask)
+{
+    log_mask_ = mask;
+    applyMask();
+}
+
+void CECLog::setTrace(bool trace)
+{
+    trace_ = trace;
+    applyMask();
+}
+
+void CECLog::applyMask()
+{
+    auto detail = [this](uint16_t bit) {return (log_mask_ & bit) != 0 ? LogLevel::Debug : LogLevel::Info;};
+    setLevel(LogCategory::General, detail(1));
+    setLevel(LogCategory::Libcec, LogLevel::Info);
+    setLevel(LogCategory::CecRx, trace_ ? LogLevel::Trace : detail(1));
+    setLevel(LogCategory::CecTx, trace_ ? LogLevel::Trace : detail(1));
+    setLevel(LogCategory::Volume, trace_ ? LogLevel::Trace : detail(1));
+    setLevel(LogCategory::Ws, trace_ ? LogLevel::Trace : detail(2));
+    setLevel(LogCategory::Health, detail(4));
+}
+
+const char *CECLog::categoryName(LogCategory category)
+{
+    int ii = static_cast<int>(category);
+    return ii < kCategories ? kCategoryNames[ii] : "?";
+}
+
+const char *CECLog::levelName(LogLevel level)
+{
+    int ii = static_cast<int>(level);
+    return ii <= static_cast<int>(LogLevel::Trace) ? kLevelNames[ii] : "?";
+}
+
+bool CECLog::parseCategory(const char *name, LogCategory *category)
+{
+    for (int ii = 0; ii < kCategories; ii++)
+    {
+        if (strcasecmp(name, kCategoryNames[ii]) == 0)
+        {
+            *category = static_cast<LogCategory>(ii);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CECLog::parseLevel(const char *name, LogLevel *level)
+{
+    for (int ii = 0; ii <= static_cast<int>(LogLevel::Trace); ii++)
     {
-        FILE *f = fopen(log_file_, "a");
-        if (f)
+        if (strcasecmp(name, kLevelNames[ii]) == 0)
         {
-            fprintf(f, "%s ", timbuf);
-            vfprintf(f, format, ap);
-            fprintf(f, "\n");
-            fclose(f);
+            *level = static_cast<LogLevel>(ii);
+            return true;
         }
     }
-    printf("%s ", timbuf);
-    vprintf(format, ap);
-    printf("\n");
-    fflush(stdout);
+    return false;
 }
 
-void CECLog::print(const char *format, ...)
+void CECLog::print(LogCategory category, const char *format, va_list ap)
+{
+    //  Claim a slot
+    uint32_t pos = head_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true)
+    {
+        slot = &ring_[pos & (kSlots - 1)];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(seq - pos);
+        if (diff == 0)
+        {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    //  Format the time stamp once per second per thread
+    thread_local time_t stamp_time = 0;
+    thread_local char   stamp[32];
+    thread_local int    stamp_len = 0;
+    time_t now;
+    time(&now);
+    if (now != stamp_time)
+    {
+        struct tm tmnow;
+        localtime_r(&now, &tmnow);
+        stamp_len = strftime(stamp, sizeof(stamp), "%m/%d %H:%M:%S ", &tmnow);
+        stamp_time = now;
+    }
+
+    //  Format the line directly into the slot
+    memcpy(slot->text, stamp, stamp_len);
+    size_t prefix = stamp_len;
+    if (category != LogCategory::General)
+    {
+        const char *name = categoryName(category);
+        size_t name_len = strlen(name);
+        memcpy(slot->text + prefix, name, name_len);
+        memcpy(slot->text + prefix + name_len, ": ", 2);
+        prefix += name_len + 2;
+    }
+    int n = vsnprintf(slot->text + prefix, kLineSize - prefix - 1, format, ap);
+    size_t len = prefix + (n < 0 ? 0 : n);
+    if (len > kLineSize - 2)
+    {
+        len = kLineSize - 2;
+    }
+    slot->text[len++] = '\n';
+    slot->len = len;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    //  Wake the writer early on bursts rather than waiting for its poll
+    if ((pos & (kSlots / 4 - 1)) == kSlots / 4 - 1)
+    {
+        wake_.notify_one();
+    }
+}
+
+void CECLog::print(LogCategory category, const char *format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    print(format, ap);
+    print(category, format, ap);
     va_end(ap);
 }
 
-void CECLog::print(const uint16_t &mask, const char *format, ...)
+void CECLog::writerLoop()
+{
+    const size_t batchSize = 64 * 1024;
+    char *batch = new char[batchSize];
+    while (true)
+    {
+        bool running = running_.load();
+        size_t limit;
+        {
+            //  Keep each batch within one file so rotation honours the size cap
+            std::lock_guard<std::mutex> lk(fileMtx_);
+            limit = max_file_size_ < batchSize ? max_file_size_ : batchSize;
+        }
+        size_t len;
+        while ((len = drain(batch, limit)) > 0)
+        {
+            writeBatch(batch, len);
+        }
+        if (!running)
+        {
+            break;
+        }
+        std::unique_lock<std::mutex> lk(wakeMtx_);
+        wake_.wait_for(lk, std::chrono::milliseconds(100));
+    }
+    delete[] batch;
+}
+
+size_t CECLog::drain(char *batch, size_t batchSize)
 {
-    if ((mask & log_mask_) != 0)
+    size_t len = 0;
+    uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        len = snprintf(batch, batchSize, "***** %u log lines dropped\n", dropped);
+    }
+    while (len + kLineSize <= batchSize || len == 0)
     {
-        va_list ap;
-        va_start(ap, format);
-        print(format, ap);
-        va_end(ap);
+        Slot *slot = &ring_[tail_ & (kSlots - 1)];
+        if (slot->seq.load(std::memory_order_acquire) != tail_ + 1)
+        {
+            break;
+        }
+        memcpy(batch + len, slot->text, slot->len);
+        len += slot->len;
+        slot->seq.store(tail_ + kSlots, std::memory_order_release);
+        tail_++;
+    }
+    return len;
+}
+
+void CECLog::writeBatch(const char *batch, size_t len)
+{
+    std::lock_guard<std::mutex> lk(fileMtx_);
+    if (log_file_)
+    {
+        if (fd_ >= 0 && file_size_ > 0 && file_size_ + len > max_file_size_)
+        {
+            rotate();
+        }
+        if (fd_ < 0)
+        {
+            openLogFile();
+        }
+        if (fd_ >= 0)
+        {
+            ssize_t n = write(fd_, batch, len);
+            if (n > 0)
+            {
+                file_size_ += n;
+            }
+        }
+    }
+    ssize_t n = write(STDOUT_FILENO, batch, len);
+    (void)n;
+}
+
+void CECLog::openLogFile()
+{
+    fd_ = open(log_file_, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    file_size_ = 0;
+    struct stat st;
+    if (fd_ >= 0 && fstat(fd_, &st) == 0)
+    {
+        file_size_ = st.st_size;
+    }
+}
+
+void CECLog::rotate()
+{
+    //  Keep log, log.1 ... log.(n-1) so that all files fit in max_total_size_
+    close(fd_);
+    fd_ = -1;
+    size_t nfiles = max_total_size_ / max_file_size_;
+    std::string base(log_file_);
+    if (nfiles <= 1)
+    {
+        unlink(base.c_str());
+    }
+    else
+    {
+        unlink((base + "." + std::to_string(nfiles - 1)).c_str());
+        for (size_t ii = nfiles - 1; ii > 1; ii--)
+        {
+            rename((base + "." + std::to_string(ii - 1)).c_str(), (base + "." + std::to_string(ii)).c_str());
+        }
+        rename(base.c_str(), (base + ".1").c_str());
     }
+    openLogFile();
 }
@@ -3,23 +3,136 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
+//  Log categories, each with its own runtime level
+enum class LogCategory : uint8_t
+{
+    General,
+    Libcec,                                     // libcec's own messages
+    CecRx,                                      // CEC frames and events received
+    CecTx,                                      // CEC keys and sequences sent
+    Ws,                                         // Remote links
+    Volume,                                     // Volume and mute
+    Health,                                     // Pings and queue depth
+    kCount
+};
+
+enum class LogLevel : uint8_t
+{
+    Error,
+    Warn,
+    Info,
+    Debug,
+    Trace
+};
+
+//  Statements above this level are compiled out (Release builds stop at Debug)
+#ifndef TVCEC_LOG_LEVEL
+#define TVCEC_LOG_LEVEL 4
+#endif
+
+//  CECLOG(log_, Ws, Debug, "Sent %d bytes", n)
+//
+//  The arguments are only evaluated when the category is on at that level,
+//  which costs one relaxed load. CECLOG_ON() is the same test for statements
+//  that need work done before printing.
+#define CECLOG_ON(log, category, level) \
+    (static_cast<int>(LogLevel::level) <= TVCEC_LOG_LEVEL && \
+     (log)->enabled(LogCategory::category, LogLevel::level))
+
+#define CECLOG(log, category, level, ...) \
+    do \
+    { \
+        if constexpr (static_cast<int>(LogLevel::level) <= TVCEC_LOG_LEVEL) \
+        { \
+            if ((log)->enabled(LogCategory::category, LogLevel::level)) \
+            { \
+                (log)->print(LogCategory::category, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+//  Asynchronous logger
+//
+//  Callers format their line directly into a slot of a lock-free multi-producer
+//  ring and return. A single writer thread drains the ring in batches to one
+//  persistent file descriptor (and stdout), rotating the file by size. Lines
+//  other than General ones are prefixed with their category name.
 class CECLog
 {
 private:
-    uint16_t            log_mask_;              // Log detail mask
-    char                *log_file_;             // Log file name
+    static const uint32_t   kSlots = 1024;      // Ring slots (power of 2)
+    static const size_t     kLineSize = 256;    // Maximum formatted line length
+
+    struct Slot
+    {
+        std::atomic<uint32_t>   seq;            // Slot sequence (Vyukov bounded queue)
+        uint16_t                len;            // Formatted length
+        char                    text[kLineSize];
+    };
 
-    void print(const char *format, va_list ap);
+    static const int        kCategories = static_cast<int>(LogCategory::kCount);
+
+    std::atomic<uint8_t>    levels_[kCategories];   // Runtime level per category
+    uint16_t                log_mask_;          // Old style detail mask
+    bool                    trace_;             // CEC detail asked for
+    char                    *log_file_;         // Log file name
+
+    Slot                    *ring_;             // Line ring
+    std::atomic<uint32_t>   head_;              // Next slot to claim (producers)
+    uint32_t                tail_;              // Next slot to write (writer thread)
+    std::atomic<uint32_t>   dropped_;           // Lines dropped on full ring
+
+    std::thread             writer_;            // Background writer
+    std::atomic<bool>       running_;           // Writer run flag
+    std::mutex              wakeMtx_;           // Writer wakeup
+    std::condition_variable wake_;
+    std::mutex              fileMtx_;           // Guards log_file_ and fd_
+
+    int                     fd_;                // Open log file or -1
+    size_t                  file_size_;         // Bytes in current file
+    size_t                  max_file_size_;     // Rotate when file reaches this size
+    size_t                  max_total_size_;    // Cap on all log files together
+
+    void print(LogCategory category, const char *format, va_list ap);
+    void applyMask();
+
+    void writerLoop();
+    size_t drain(char *batch, size_t batchSize);
+    void writeBatch(const char *batch, size_t len);
+    void openLogFile();
+    void rotate();
 
 public:
     CECLog();
     ~CECLog();
 
-    void setMask(const uint16_t &mask) { log_mask_ = mask; }
+    bool enabled(LogCategory category, LogLevel level) const
+            {return static_cast<uint8_t>(level) <= levels_[static_cast<int>(category)].load(std::memory_order_relaxed);}
+    LogLevel level(LogCategory category) const
+            {return static_cast<LogLevel>(levels_[static_cast<int>(category)].load(std::memory_order_relaxed));}
+    void setLevel(LogCategory category, LogLevel level)
+            {levels_[static_cast<int>(category)].store(static_cast<uint8_t>(level), std::memory_order_relaxed);}
+
+    //  Mask bits 1 (CEC and volume), 2 (remotes) and 4 (health) put their
+    //  categories at Debug, otherwise Info; trace puts the CEC, volume and
+    //  remote categories at Trace. Either one resets all the levels.
+    void setMask(const uint16_t &mask);
+    void setTrace(bool trace);
+
     void setLogFile(const char *filename);
-    void print(const char *format, ...);
-    void print(const uint16_t &mask, const char *format, ...);
+    void setRotation(size_t maxFileSize, size_t maxTotalSize);
+    void print(LogCategory category, const char *format, ...);
+
+    static const char *categoryName(LogCategory category);
+    static const char *levelName(LogLevel level);
+    static bool parseCategory(const char *name, LogCategory *category);
+    static bool parseLevel(const char *name, LogLevel *level);
 };
 
 #endif // CECLOG_H
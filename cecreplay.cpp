@@ -0,0 +1,286 @@
+#include "cecreplay.h"
+#include "monotonic.h"
+#include <string.h>
+#include <chrono>
+
+CECReplayAdapter::CECReplayAdapter(double speed) : speed_(speed), callbacks_(nullptr), cbparam_(nullptr), running_(false),
+    active_(CEC::CECDEVICE_UNKNOWN), delivered_(0), transmitted_(0)
+{
+    for (int ii = 0; ii < 16; ii++)
+    {
+        power_[ii] = CEC::CEC_POWER_STATUS_UNKNOWN;
+        physical_[ii] = 0xffff;
+        vendor_[ii] = 0;
+    }
+}
+
+CECReplayAdapter::~CECReplayAdapter()
+{
+    Close();
+}
+
+bool CECReplayAdapter::load(const char *filename)
+{
+    return CECTrace::read(filename, records_);
+}
+
+bool CECReplayAdapter::SetCallbacks(CEC::ICECCallbacks *callbacks, void *cbParam)
+{
+    callbacks_ = callbacks;
+    cbparam_ = cbParam;
+    return true;
+}
+
+int8_t CECReplayAdapter::DetectAdapters(CEC::cec_adapter_descriptor *deviceList, uint8_t iBufSize,
+                                        const char *strDevicePath, bool bQuickScan)
+{
+    if (iBufSize == 0)
+    {
+        return 0;
+    }
+    memset(&deviceList[0], 0, sizeof(deviceList[0]));
+    strncpy(deviceList[0].strComName, "replay", sizeof(deviceList[0].strComName) - 1);
+    strncpy(deviceList[0].strComPath, "replay", sizeof(deviceList[0].strComPath) - 1);
+    return 1;
+}
+
+bool CECReplayAdapter::Open(const char *strPort, uint32_t iTimeoutMs)
+{
+    Close();
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        running_ = true;
+    }
+    thread_ = std::thread(&CECReplayAdapter::replayLoop, this);
+    return true;
+}
+
+void CECReplayAdapter::Close()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void CECReplayAdapter::replayLoop()
+{
+    int64_t start = monotonicNs();
+    uint64_t first = records_.empty() ? 0 : records_.front().timestamp;
+    CEC::cec_user_control_code pressed = CEC::CEC_USER_CONTROL_CODE_UNKNOWN;
+    int64_t pressed_at = 0;
+
+    for (const CECTrace::Record &rec : records_)
+    {
+        if (rec.direction != CECTrace::Received)
+        {
+            continue;
+        }
+
+        //  Sleep until the frame is due on an absolute deadline so delays do not accumulate
+        if (speed_ > 0)
+        {
+            int64_t due = start + static_cast<int64_t>((rec.timestamp - first) / speed_);
+            std::unique_lock<std::mutex> lk(mtx_);
+            wake_.wait_until(lk, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(due)),
+                             [this]() {return !running_;});
+        }
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (!running_)
+            {
+                return;
+            }
+        }
+
+        CEC::cec_command command;
+        command.Clear();
+        command.initiator = static_cast<CEC::cec_logical_address>(rec.initiator);
+        command.destination = static_cast<CEC::cec_logical_address>(rec.destination);
+        command.opcode_set = rec.opcode_set;
+        if (rec.opcode_set)
+        {
+            command.opcode = static_cast<CEC::cec_opcode>(rec.opcode);
+        }
+        for (int ii = 0; ii < rec.size && ii < static_cast<int>(sizeof(rec.data)); ii++)
+        {
+            command.parameters.PushBack(rec.data[ii]);
+        }
+        apply(command);
+
+        if (callbacks_ && callbacks_->commandHandler)
+        {
+            callbacks_->commandHandler(cbparam_, &command);
+        }
+
+        //  libcec reports key presses with duration 0 and releases with the time held
+        if (callbacks_ && callbacks_->keyPress && rec.opcode_set)
+        {
+            CEC::cec_keypress key;
+            if (rec.opcode == CEC::CEC_OPCODE_USER_CONTROL_PRESSED && rec.size > 0)
+            {
+                pressed = static_cast<CEC::cec_user_control_code>(rec.data[0]);
+                pressed_at = rec.timestamp;
+                key.keycode = pressed;
+                key.duration = 0;
+                callbacks_->keyPress(cbparam_, &key);
+            }
+            else if (rec.opcode == CEC::CEC_OPCODE_USER_CONTROL_RELEASE && pressed != CEC::CEC_USER_CONTROL_CODE_UNKNOWN)
+            {
+                key.keycode = pressed;
+                key.duration = static_cast<unsigned int>((rec.timestamp - pressed_at) / 1000000);
+                if (key.duration == 0)
+                {
+                    key.duration = 1;
+                }
+                callbacks_->keyPress(cbparam_, &key);
+                pressed = CEC::CEC_USER_CONTROL_CODE_UNKNOWN;
+            }
+        }
+        delivered_.fetch_add(1);
+    }
+
+    if (finished_)
+    {
+        finished_();
+    }
+}
+
+void CECReplayAdapter::apply(const CEC::cec_command &command)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    int from = command.initiator & 0x0f;
+    uint16_t physical = (command.parameters.At(0) << 8) | command.parameters.At(1);
+    switch (command.opcode)
+    {
+    case CEC::CEC_OPCODE_REPORT_POWER_STATUS:
+        power_[from] = static_cast<CEC::cec_power_status>(command.parameters.At(0));
+        break;
+
+    case CEC::CEC_OPCODE_STANDBY:
+        for (int ii = 0; ii < 16; ii++)
+        {
+            power_[ii] = CEC::CEC_POWER_STATUS_STANDBY;
+        }
+        active_ = CEC::CECDEVICE_UNKNOWN;
+        break;
+
+    case CEC::CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+        physical_[from] = physical;
+        break;
+
+    case CEC::CEC_OPCODE_SET_OSD_NAME:
+        osd_name_[from] = std::string(reinterpret_cast<const char *>(command.parameters.data), command.parameters.size);
+        break;
+
+    case CEC::CEC_OPCODE_DEVICE_VENDOR_ID:
+        vendor_[from] = (command.parameters.At(0) << 16) + (command.parameters.At(1) << 8) + command.parameters.At(2);
+        break;
+
+    case CEC::CEC_OPCODE_ACTIVE_SOURCE:
+        physical_[from] = physical;
+        active_ = command.initiator;
+        break;
+
+    case CEC::CEC_OPCODE_ROUTING_CHANGE:
+        physical = (command.parameters.At(2) << 8) | command.parameters.At(3);
+        // fall through
+    case CEC::CEC_OPCODE_SET_STREAM_PATH:
+        for (int ii = 0; ii < 15; ii++)
+        {
+            if (physical_[ii] == physical)
+            {
+                active_ = static_cast<CEC::cec_logical_address>(ii);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+    if (power_[from] == CEC::CEC_POWER_STATUS_UNKNOWN && command.opcode_set)
+    {
+        //  Anything talking is at least awake
+        power_[from] = CEC::CEC_POWER_STATUS_ON;
+    }
+}
+
+bool CECReplayAdapter::Transmit(const CEC::cec_command &data)
+{
+    transmitted_.fetch_add(1);
+    return true;
+}
+
+bool CECReplayAdapter::SendKeypress(CEC::cec_logical_address iDestination, CEC::cec_user_control_code key, bool bWait)
+{
+    transmitted_.fetch_add(1);
+    return true;
+}
+
+bool CECReplayAdapter::SendKeyRelease(CEC::cec_logical_address iDestination, bool bWait)
+{
+    transmitted_.fetch_add(1);
+    return true;
+}
+
+CEC::cec_power_status CECReplayAdapter::GetDevicePowerStatus(CEC::cec_logical_address iLogicalAddress)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return iLogicalAddress >= 0 && iLogicalAddress < 16 ? power_[iLogicalAddress] : CEC::CEC_POWER_STATUS_UNKNOWN;
+}
+
+CEC::cec_logical_address CECReplayAdapter::GetActiveSource()
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return active_;
+}
+
+CEC::cec_logical_addresses CECReplayAdapter::GetActiveDevices()
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    CEC::cec_logical_addresses ret;
+    ret.Clear();
+    for (int ii = 0; ii < 15; ii++)
+    {
+        if (physical_[ii] != 0xffff)
+        {
+            ret.Set(static_cast<CEC::cec_logical_address>(ii));
+        }
+    }
+    return ret;
+}
+
+uint16_t CECReplayAdapter::GetDevicePhysicalAddress(CEC::cec_logical_address iLogicalAddress)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return iLogicalAddress >= 0 && iLogicalAddress < 16 ? physical_[iLogicalAddress] : 0xffff;
+}
+
+std::string CECReplayAdapter::GetDeviceOSDName(CEC::cec_logical_address iAddress)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return iAddress >= 0 && iAddress < 16 ? osd_name_[iAddress] : std::string();
+}
+
+uint32_t CECReplayAdapter::GetDeviceVendorId(CEC::cec_logical_address iLogicalAddress)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return iLogicalAddress >= 0 && iLogicalAddress < 16 ? vendor_[iLogicalAddress] : 0;
+}
+
+const char *CECReplayAdapter::ToString(const CEC::cec_power_status status)
+{
+    switch (status)
+    {
+    case CEC::CEC_POWER_STATUS_ON:                          return "on";
+    case CEC::CEC_POWER_STATUS_STANDBY:                     return "standby";
+    case CEC::CEC_POWER_STATUS_IN_TRANSITION_STANDBY_TO_ON: return "in transition from standby to on";
+    case CEC::CEC_POWER_STATUS_IN_TRANSITION_ON_TO_STANDBY: return "in transition from on to standby";
+    default:                                                return "unknown";
+    }
+}
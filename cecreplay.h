@@ -0,0 +1,80 @@
+#ifndef CECREPLAY_H
+#define CECREPLAY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cecadapter.h"
+#include "cectrace.h"
+
+//  Trace replay adapter
+//
+//  Stands in for libcec on a machine without a CEC bus. The received frames of a
+//  flight recorder file are delivered to commandHandler from a replay thread, as
+//  libcec does, keeping their original spacing divided by the speed factor (0 is
+//  as fast as possible). User control frames are also delivered to keyPress.
+//  Queries are answered from the state the replayed frames have reported so far
+//  and transmitted frames are only counted.
+class CECReplayAdapter : public CECAdapter
+{
+private:
+    std::vector<CECTrace::Record>   records_;       // Trace, oldest first
+    double                  speed_;                 // Replay speed factor
+    CEC::ICECCallbacks      *callbacks_;            // Registered callbacks
+    void                    *cbparam_;              // Callback parameter
+
+    std::thread             thread_;                // Replay thread
+    bool                    running_;               // Replay run flag (guarded by mtx_)
+    std::condition_variable wake_;                  // Interrupts the replay sleep on Close()
+    std::function<void()>   finished_;              // Called from the replay thread at the end
+
+    mutable std::mutex      mtx_;                   // Guards the device state below
+    CEC::cec_power_status   power_[16];             // Reported power status
+    uint16_t                physical_[16];          // Reported physical addresses (0xffff unknown)
+    std::string             osd_name_[16];          // Reported OSD names
+    uint32_t                vendor_[16];            // Reported vendor ids
+    CEC::cec_logical_address active_;               // Active source
+
+    std::atomic<uint32_t>   delivered_;             // Frames delivered
+    std::atomic<uint32_t>   transmitted_;           // Frames sent by tvcec
+
+    void replayLoop();
+    void apply(const CEC::cec_command &command);
+
+public:
+    explicit CECReplayAdapter(double speed = 1.0);
+    virtual ~CECReplayAdapter();
+
+    bool load(const char *filename);
+    void setFinished(std::function<void()> finished) {finished_ = finished;}
+    size_t frames() const {return records_.size();}
+    uint32_t delivered() const {return delivered_.load();}
+    uint32_t transmitted() const {return transmitted_.load();}
+
+    bool SetCallbacks(CEC::ICECCallbacks *callbacks, void *cbParam) override;
+    int8_t DetectAdapters(CEC::cec_adapter_descriptor *deviceList, uint8_t iBufSize,
+                          const char *strDevicePath = nullptr, bool bQuickScan = false) override;
+    bool Open(const char *strPort, uint32_t iTimeoutMs = 10000) override;
+    void Close() override;
+
+    bool Transmit(const CEC::cec_command &data) override;
+    bool SendKeypress(CEC::cec_logical_address iDestination, CEC::cec_user_control_code key, bool bWait = false) override;
+    bool SendKeyRelease(CEC::cec_logical_address iDestination, bool bWait = false) override;
+
+    CEC::cec_power_status GetDevicePowerStatus(CEC::cec_logical_address iLogicalAddress) override;
+    CEC::cec_logical_address GetActiveSource() override;
+    CEC::cec_logical_addresses GetActiveDevices() override;
+    uint16_t GetDevicePhysicalAddress(CEC::cec_logical_address iLogicalAddress) override;
+    std::string GetDeviceOSDName(CEC::cec_logical_address iAddress) override;
+    uint32_t GetDeviceVendorId(CEC::cec_logical_address iLogicalAddress) override;
+
+    const char *ToString(const CEC::cec_opcode opcode) override {return CECTrace::opcodeName(opcode);}
+    const char *ToString(const CEC::cec_power_status status) override;
+};
+
+#endif // CECREPLAY_H
@@ -0,0 +1,268 @@
+#include "cecsequence.h"
+#include "cecaudio.h"
+#include "ceckeyrepeat.h"
+#include "ceclog.h"
+#include "monotonic.h"
+#include <QJsonObject>
+#include <QJsonValue>
+
+static_assert(CECSequence::kRepeatInterval >= CECKeyRepeat::kMinInterval &&
+              CECSequence::kRepeatInterval <= CECKeyRepeat::kMaxInterval, "sequence key repeat outside the CEC bounds");
+
+CECSequence::CECSequence(CECAudio *cec, CECLog *log, QObject *parent) : QObject{parent}, cec_(cec), log_(log),
+    index_(-1), held_(false), hold_left_(0), start_(0), due_(0)
+{
+    timer_ = new QTimer(this);
+    timer_->setSingleShot(true);
+    timer_->setTimerType(Qt::PreciseTimer);
+    connect(timer_, &QTimer::timeout, this, &CECSequence::run);
+}
+
+//  Optional integer field; false if present but not a number in [min, max]
+static bool readInt(const QJsonObject &obj, const char *name, int min, int max, int &value)
+{
+    QJsonValue val = obj.value(name);
+    if (val.isUndefined())
+    {
+        return true;
+    }
+    if (!val.isDouble() || val.toDouble() < min || val.toDouble() > max)
+    {
+        return false;
+    }
+    value = val.toInt();
+    return true;
+}
+
+static bool stepError(QString *error, int index, const char *what)
+{
+    if (error)
+    {
+        *error = QString("step %1: %2").arg(index).arg(what);
+    }
+    return false;
+}
+
+bool CECSequence::parse(const QJsonArray &list, QVector<Step> &steps, QString *error)
+{
+    steps.clear();
+    if (list.isEmpty() || list.size() > kMaxSteps)
+    {
+        if (error)
+        {
+            *error = QString("sequence needs 1 to %1 steps").arg(kMaxSteps);
+        }
+        return false;
+    }
+
+    for (int ii = 0; ii < list.size(); ii++)
+    {
+        if (!list.at(ii).isObject())
+        {
+            return stepError(error, ii, "not an object");
+        }
+        QJsonObject obj = list.at(ii).toObject();
+        Step step = {};
+        step.destination = CEC::CECDEVICE_UNKNOWN;
+        int code = 0;
+        if (obj.contains("key"))
+        {
+            //  TVs drop keys that arrive back to back, so keys get a default gap
+            step.kind = Step::Key;
+            step.hold = 100;
+            step.gap = 100;
+            if (!readInt(obj, "key", 0, 0xff, code))
+            {
+                return stepError(error, ii, "bad key code");
+            }
+            if (!readInt(obj, "hold", 0, kMaxDelay, step.hold))
+            {
+                return stepError(error, ii, "bad hold time");
+            }
+        }
+        else if (obj.contains("opcode"))
+        {
+            step.kind = Step::Command;
+            int dest = CEC::CECDEVICE_UNKNOWN;
+            if (!readInt(obj, "opcode", 0, 0xff, code))
+            {
+                return stepError(error, ii, "bad opcode");
+            }
+            if (!readInt(obj, "dest", 0, 15, dest))
+            {
+                return stepError(error, ii, "bad destination");
+            }
+            step.destination = static_cast<CEC::cec_logical_address>(dest);
+            QJsonValue params = obj.value("params");
+            if (!params.isUndefined())
+            {
+                QJsonArray bytes = params.toArray();
+                if (!params.isArray() || bytes.size() > kMaxParams)
+                {
+                    return stepError(error, ii, "bad parameters");
+                }
+                for (const QJsonValue &byte : bytes)
+                {
+                    if (!byte.isDouble() || byte.toDouble() < 0 || byte.toDouble() > 0xff)
+                    {
+                        return stepError(error, ii, "bad parameter byte");
+                    }
+                    step.params[step.size++] = static_cast<uint8_t>(byte.toInt());
+                }
+            }
+        }
+        else if (obj.contains("wait"))
+        {
+            step.kind = Step::Wait;
+            if (!readInt(obj, "wait", 0, kMaxDelay, step.gap))
+            {
+                return stepError(error, ii, "bad wait time");
+            }
+        }
+        else
+        {
+            return stepError(error, ii, "needs key, opcode or wait");
+        }
+        if (step.kind != Step::Wait && !readInt(obj, "gap", 0, kMaxDelay, step.gap))
+        {
+            return stepError(error, ii, "bad gap");
+        }
+        step.code = static_cast<uint8_t>(code);
+        steps.append(step);
+    }
+    return true;
+}
+
+const char *CECSequence::statusName(Status status)
+{
+    switch (status)
+    {
+    case Done:      return "done";
+    case Failed:    return "failed";
+    case Cancelled: return "cancelled";
+    }
+    return "unknown";
+}
+
+void CECSequence::start(const QString &id, const QVector<Step> &steps)
+{
+    cancel();
+    steps_ = steps;
+    id_ = id;
+    index_ = 0;
+    held_ = false;
+    hold_left_ = 0;
+    start_ = monotonicNs();
+    due_ = start_;
+    CECLOG(log_, CecTx, Debug, "Sequence %s: %d steps", qPrintable(id_), static_cast<int>(steps_.size()));
+    run();
+}
+
+void CECSequence::cancel()
+{
+    if (running())
+    {
+        finish(Cancelled);
+    }
+}
+
+void CECSequence::schedule(int msec)
+{
+    //  Deadlines are absolute so a late timer shortens the next wait rather than
+    //  pushing the rest of the sequence back
+    due_ += static_cast<int64_t>(msec) * 1000000;
+    int64_t wait = due_ - monotonicNs();
+    timer_->start(wait > 0 ? static_cast<int>((wait + 999999) / 1000000) : 0);
+}
+
+void CECSequence::scheduleHold()
+{
+    int msec = qMin(hold_left_, static_cast<int>(kRepeatInterval));
+    hold_left_ -= msec;
+    schedule(msec);
+}
+
+void CECSequence::run()
+{
+    while (running() && index_ < steps_.size())
+    {
+        const Step &step = steps_.at(index_);
+        if (held_ && hold_left_ > 0)
+        {
+            if (!cec_->sendUserKeyPress(static_cast<CEC::cec_user_control_code>(step.code), 0))
+            {
+                finish(Failed, "key repeat not sent");
+                return;
+            }
+            scheduleHold();
+            return;
+        }
+        if (held_)
+        {
+            held_ = false;
+            if (!cec_->sendUserKeyRelease())
+            {
+                finish(Failed, "key release not sent");
+                return;
+            }
+        }
+        else
+        {
+            switch (step.kind)
+            {
+            case Step::Key:
+                if (!cec_->sendUserKeyPress(static_cast<CEC::cec_user_control_code>(step.code), 0))
+                {
+                    finish(Failed, "key press not sent");
+                    return;
+                }
+                held_ = true;
+                hold_left_ = step.hold;
+                scheduleHold();
+                return;
+
+            case Step::Command:
+                if (!cec_->sendCommand(step.destination, static_cast<CEC::cec_opcode>(step.code), step.params, step.size))
+                {
+                    finish(Failed, "command not acknowledged");
+                    return;
+                }
+                break;
+
+            case Step::Wait:
+                break;
+            }
+        }
+
+        index_++;
+        if (step.gap > 0)
+        {
+            schedule(step.gap);
+            return;
+        }
+    }
+    if (running())
+    {
+        finish(Done);
+    }
+}
+
+void CECSequence::finish(Status status, const QString &error)
+{
+    timer_->stop();
+    if (held_)
+    {
+        //  Never leave a key pressed on the bus
+        held_ = false;
+        cec_->sendUserKeyRelease();
+    }
+    int step = index_;
+    int elapsed = static_cast<int>((monotonicNs() - start_) / 1000000);
+    QString id = id_;
+    index_ = -1;
+    steps_.clear();
+    id_.clear();
+    CECLOG(log_, CecTx, Debug, "Sequence %s %s at step %d after %d msec%s%s", qPrintable(id), statusName(status), step, elapsed,
+           error.isEmpty() ? "" : ": ", qPrintable(error));
+    emit finished(id, status, step, elapsed, error);
+}
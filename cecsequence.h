@@ -0,0 +1,97 @@
+#ifndef CECSEQUENCE_H
+#define CECSEQUENCE_H
+
+#include <QJsonArray>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+#include <libcec/cec.h>
+
+class CECAudio;
+class CECLog;
+
+//  Key and command sequences run locally
+//
+//  A remote sends the whole sequence in one message instead of one round trip
+//  per key. Each step is a key (pressed for hold msec), a raw CEC command or a
+//  pause, followed by gap msec before the next step. Steps are scheduled on
+//  absolute monotonic deadlines so timer lateness does not accumulate. A key
+//  held longer than the CEC repeat interval has its press repeated, as
+//  CECKeyRepeat does, so followers do not take the hold for a release. Starting
+//  a new sequence cancels the running one, releasing any key still held.
+//
+//      [{"key": 9, "hold": 100, "gap": 150}, {"wait": 500},
+//       {"opcode": 68, "dest": 4, "params": [1]}]
+class CECSequence : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int    kMaxSteps = 64;         // Steps per sequence
+    static const int    kMaxDelay = 10000;      // Longest hold, gap or wait (msec)
+    static const int    kMaxParams = 14;        // CEC parameter bytes per frame
+    static const int    kRepeatInterval = 400;  // Press repeat while a key is held (msec)
+
+    struct Step
+    {
+        enum Kind : uint8_t
+        {
+            Key,
+            Command,
+            Wait
+        };
+        Kind                        kind;
+        uint8_t                     code;           // Key code or opcode
+        CEC::cec_logical_address    destination;    // Command destination, unknown for the active source
+        uint8_t                     params[kMaxParams];
+        int                         size;           // Command parameter bytes
+        int                         hold;           // Key press to release (msec)
+        int                         gap;            // End of this step to the next one (msec)
+    };
+
+    enum Status
+    {
+        Done,
+        Failed,
+        Cancelled
+    };
+
+private:
+    CECAudio            *cec_;                  // Sends the keys and commands
+    CECLog              *log_;                  // Logger
+    QTimer              *timer_;                // Next step timer
+    QVector<Step>       steps_;                 // Running sequence
+    QString             id_;                    // Requester's id for the running sequence
+    int                 index_;                 // Step being run
+    bool                held_;                  // Key of the current step is pressed
+    int                 hold_left_;             // Hold time after the next timeout (msec)
+    int64_t             start_;                 // Monotonic nsec the sequence started
+    int64_t             due_;                   // Monotonic nsec the next action is due
+
+    void schedule(int msec);
+    void scheduleHold();
+    void finish(Status status, const QString &error = QString());
+
+public:
+    CECSequence(CECAudio *cec, CECLog *log, QObject *parent = nullptr);
+
+    static bool parse(const QJsonArray &list, QVector<Step> &steps, QString *error = nullptr);
+    static const char *statusName(Status status);
+
+    bool running() const {return index_ >= 0;}
+    CECAudio *cec() const {return cec_;}
+    void setCEC(CECAudio *cec) {if (cec != cec_) {cancel(); cec_ = cec;}}
+    void start(const QString &id, const QVector<Step> &steps);
+
+public slots:
+    void cancel();
+
+private slots:
+    void run();
+
+signals:
+    void finished(const QString &id, CECSequence::Status status, int step, int elapsedMs, const QString &error);
+};
+
+#endif // CECSEQUENCE_H
@@ -0,0 +1,119 @@
+#include "cectopology.h"
+#include <QMutexLocker>
+
+CECTopology::CECTopology()
+{
+    for (int ii = 0; ii < 16; ii++)
+    {
+        physical_[ii] = kUnknown;
+    }
+}
+
+void CECTopology::update(CEC::cec_logical_address logical, uint16_t physical)
+{
+    if (logical < CEC::CECDEVICE_TV || logical >= CEC::CECDEVICE_BROADCAST || physical == kUnknown)
+    {
+        return;
+    }
+    QMutexLocker lk(&mtx_);
+    missing_.remove(physical);
+    if (physical_[logical] == physical)
+    {
+        return;
+    }
+    removeLocked(logical);
+    auto it = by_physical_.find(physical);
+    if (it != by_physical_.end())
+    {
+        //  A physical address belongs to one device at a time
+        physical_[it.value()] = kUnknown;
+        by_physical_.erase(it);
+    }
+    by_physical_.insert(physical, logical);
+    physical_[logical] = physical;
+}
+
+void CECTopology::remove(CEC::cec_logical_address logical)
+{
+    if (logical < CEC::CECDEVICE_TV || logical >= CEC::CECDEVICE_BROADCAST)
+    {
+        return;
+    }
+    QMutexLocker lk(&mtx_);
+    removeLocked(logical);
+}
+
+void CECTopology::removeLocked(CEC::cec_logical_address logical)
+{
+    if (physical_[logical] != kUnknown)
+    {
+        by_physical_.remove(physical_[logical]);
+        physical_[logical] = kUnknown;
+    }
+}
+
+void CECTopology::clear()
+{
+    QMutexLocker lk(&mtx_);
+    by_physical_.clear();
+    missing_.clear();
+    for (int ii = 0; ii < 16; ii++)
+    {
+        physical_[ii] = kUnknown;
+    }
+}
+
+void CECTopology::markMissing(uint16_t physical, int64_t nowMs)
+{
+    QMutexLocker lk(&mtx_);
+    if (!by_physical_.contains(physical))
+    {
+        missing_.insert(physical, nowMs);
+    }
+}
+
+CEC::cec_logical_address CECTopology::lookup(uint16_t physical) const
+{
+    QMutexLocker lk(&mtx_);
+    return by_physical_.value(physical, CEC::CECDEVICE_UNKNOWN);
+}
+
+bool CECTopology::recentlyMissing(uint16_t physical, int64_t nowMs, int64_t maxAgeMs) const
+{
+    QMutexLocker lk(&mtx_);
+    auto it = missing_.constFind(physical);
+    return it != missing_.constEnd() && nowMs - it.value() < maxAgeMs;
+}
+
+uint16_t CECTopology::physical(CEC::cec_logical_address logical) const
+{
+    if (logical < CEC::CECDEVICE_TV || logical >= CEC::CECDEVICE_BROADCAST)
+    {
+        return kUnknown;
+    }
+    QMutexLocker lk(&mtx_);
+    return physical_[logical];
+}
+
+int CECTopology::size() const
+{
+    QMutexLocker lk(&mtx_);
+    return by_physical_.size();
+}
+
+QStringList CECTopology::dump() const
+{
+    QMutexLocker lk(&mtx_);
+    QStringList ret;
+    for (auto it = by_physical_.constBegin(); it != by_physical_.constEnd(); ++it)
+    {
+        ret << QString("%1 -> %2").arg(physicalToString(it.key())).arg(it.value());
+    }
+    return ret;
+}
+
+QString CECTopology::physicalToString(uint16_t physical)
+{
+    return QString("%1.%2.%3.%4").arg((physical >> 12) & 0xf).arg((physical >> 8) & 0xf)
+                                 .arg((physical >> 4) & 0xf).arg(physical & 0xf);
+}
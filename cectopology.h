@@ -0,0 +1,44 @@
+#ifndef CECTOPOLOGY_H
+#define CECTOPOLOGY_H
+
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+#include <libcec/cec.h>
+
+//  Physical to logical address map of the devices on the bus
+//
+//  Filled by a scan when the adapter opens and kept current from observed
+//  traffic so that resolving a physical address does not poll the bus.
+//  Addresses a scan did not find are remembered for a while, so switching to
+//  an input without a CEC device does not rescan the bus every time.
+class CECTopology
+{
+private:
+    mutable QMutex                              mtx_;
+    QMap<uint16_t, CEC::cec_logical_address>    by_physical_;   // Physical -> logical
+    uint16_t                                    physical_[16];  // Logical -> physical (0xffff unknown)
+    QMap<uint16_t, int64_t>                     missing_;       // Physical -> monotonic ms a scan last did not find it
+
+    void removeLocked(CEC::cec_logical_address logical);
+
+public:
+    static const uint16_t   kUnknown = 0xffff;
+
+    CECTopology();
+
+    void update(CEC::cec_logical_address logical, uint16_t physical);
+    void remove(CEC::cec_logical_address logical);
+    void clear();
+    void markMissing(uint16_t physical, int64_t nowMs);
+
+    CEC::cec_logical_address lookup(uint16_t physical) const;
+    bool recentlyMissing(uint16_t physical, int64_t nowMs, int64_t maxAgeMs) const;
+    uint16_t physical(CEC::cec_logical_address logical) const;
+    int size() const;
+
+    QStringList dump() const;
+    static QString physicalToString(uint16_t physical);
+};
+
+#endif // CECTOPOLOGY_H
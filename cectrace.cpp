@@ -0,0 +1,269 @@
+#include "cectrace.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char   kTraceMagic[8] = {'T', 'V', 'C', 'E', 'C', 'T', 'R', '1'};
+static const uint32_t kTraceVersion = 1;
+
+static_assert(sizeof(CECTrace::Record) == 32, "Trace record must stay 32 bytes");
+
+CECTrace::CECTrace() : header_(nullptr), records_(nullptr), map_size_(0), mask_(0)
+{
+
+}
+
+CECTrace::~CECTrace()
+{
+    close();
+}
+
+bool CECTrace::open(const char *filename, uint32_t capacity)
+{
+    close();
+
+    //  Round capacity up to a power of 2
+    uint32_t cap = 64;
+    while (cap < capacity && cap < 0x40000000)
+    {
+        cap <<= 1;
+    }
+    size_t size = sizeof(Header) + static_cast<size_t>(cap) * sizeof(Record);
+
+    int fd = ::open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    //  Reuse an existing trace of the same shape so history survives a restart
+    bool reuse = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size)
+    {
+        Header hdr;
+        if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr))
+        {
+            reuse = memcmp(hdr.magic, kTraceMagic, sizeof(kTraceMagic)) == 0 && hdr.version == kTraceVersion &&
+                    hdr.record_size == sizeof(Record) && hdr.capacity == cap;
+        }
+    }
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    header_ = static_cast<Header *>(map);
+    records_ = reinterpret_cast<Record *>(static_cast<char *>(map) + sizeof(Header));
+    map_size_ = size;
+    mask_ = cap - 1;
+    if (!reuse)
+    {
+        memcpy(header_->magic, kTraceMagic, sizeof(kTraceMagic));
+        header_->version = kTraceVersion;
+        header_->record_size = sizeof(Record);
+        header_->capacity = cap;
+        header_->head.store(0);
+    }
+
+    struct timespec mono, wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    header_->wall_offset = (wall.tv_sec - mono.tv_sec) * 1000000000LL + (wall.tv_nsec - mono.tv_nsec);
+    return true;
+}
+
+void CECTrace::close()
+{
+    if (header_)
+    {
+        munmap(header_, map_size_);
+        header_ = nullptr;
+        records_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+void CECTrace::record(Direction direction, const CEC::cec_command &command)
+{
+    if (!header_)
+    {
+        return;
+    }
+
+    uint64_t pos = header_->head.fetch_add(1, std::memory_order_relaxed);
+    Record &rec = records_[pos & mask_];
+    __atomic_store_n(&rec.seq, 0, __ATOMIC_RELAXED);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rec.timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec.direction = direction;
+    rec.initiator = static_cast<uint8_t>(command.initiator);
+    rec.destination = static_cast<uint8_t>(command.destination);
+    rec.opcode = static_cast<uint8_t>(command.opcode);
+    rec.opcode_set = command.opcode_set;
+    uint8_t size = command.parameters.size;
+    if (size > sizeof(rec.data))
+    {
+        size = sizeof(rec.data);
+    }
+    rec.size = size;
+    memcpy(rec.data, command.parameters.data, size);
+
+    __atomic_store_n(&rec.seq, static_cast<uint32_t>(pos + 1), __ATOMIC_RELEASE);
+}
+
+bool CECTrace::read(const char *filename, std::vector<Record> &records, int64_t *wallOffset)
+{
+    int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open trace file %s\n", filename);
+        return false;
+    }
+    struct stat st;
+    Header hdr;
+    if (fstat(fd, &st) != 0 || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr.magic, kTraceMagic, sizeof(kTraceMagic)) != 0 || hdr.version != kTraceVersion ||
+        hdr.record_size != sizeof(Record) ||
+        static_cast<size_t>(st.st_size) != sizeof(Header) + static_cast<size_t>(hdr.capacity) * sizeof(Record))
+    {
+        fprintf(stderr, "%s is not a tvcec trace file\n", filename);
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map trace file %s\n", filename);
+        return false;
+    }
+    const Header *header = static_cast<const Header *>(map);
+    const Record *ring = reinterpret_cast<const Record *>(static_cast<const char *>(map) + sizeof(Header));
+
+    //  Oldest to newest, skipping records that were being written
+    uint64_t head = header->head.load();
+    uint64_t start = head > hdr.capacity ? head - hdr.capacity : 0;
+    records.clear();
+    records.reserve(head - start);
+    for (uint64_t pos = start; pos < head; pos++)
+    {
+        const Record &rec = ring[pos & (hdr.capacity - 1)];
+        if (__atomic_load_n(&rec.seq, __ATOMIC_ACQUIRE) == static_cast<uint32_t>(pos + 1))
+        {
+            records.push_back(rec);
+        }
+    }
+    if (wallOffset)
+    {
+        *wallOffset = hdr.wall_offset;
+    }
+
+    munmap(map, st.st_size);
+    return true;
+}
+
+int CECTrace::dump(const char *filename, FILE *out)
+{
+    std::vector<Record> records;
+    int64_t wall_offset;
+    if (!read(filename, records, &wall_offset))
+    {
+        return 1;
+    }
+
+    uint64_t prev = 0;
+    for (const Record &rec : records)
+    {
+        //  Monotonic time is mapped to wall time with the offset from the last open
+        int64_t wall = static_cast<int64_t>(rec.timestamp) + wall_offset;
+        time_t secs = wall / 1000000000LL;
+        struct tm tmrec;
+        localtime_r(&secs, &tmrec);
+        char timbuf[32];
+        strftime(timbuf, sizeof(timbuf), "%m/%d %H:%M:%S", &tmrec);
+        double delta = prev ? (rec.timestamp - prev) / 1000000.0 : 0.0;
+        prev = rec.timestamp;
+
+        fprintf(out, "%s.%03d %+10.3f ms %s %x -> %x", timbuf, static_cast<int>((wall / 1000000LL) % 1000), delta,
+                rec.direction == Transmitted ? "tx" : "rx", rec.initiator, rec.destination);
+        if (rec.opcode_set)
+        {
+            fprintf(out, "  opcode=%02x (%s)", rec.opcode, opcodeName(rec.opcode));
+        }
+        else
+        {
+            fprintf(out, "  poll");
+        }
+        if (rec.size > 0)
+        {
+            fprintf(out, " data[%u]", rec.size);
+            for (int ii = 0; ii < rec.size && ii < static_cast<int>(sizeof(rec.data)); ii++)
+            {
+                fprintf(out, " %02x", rec.data[ii]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+    return 0;
+}
+
+const char *CECTrace::opcodeName(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case CEC::CEC_OPCODE_FEATURE_ABORT:                 return "feature abort";
+    case CEC::CEC_OPCODE_IMAGE_VIEW_ON:                 return "image view on";
+    case CEC::CEC_OPCODE_TEXT_VIEW_ON:                  return "text view on";
+    case CEC::CEC_OPCODE_SET_MENU_LANGUAGE:             return "set menu language";
+    case CEC::CEC_OPCODE_STANDBY:                       return "standby";
+    case CEC::CEC_OPCODE_USER_CONTROL_PRESSED:          return "user control pressed";
+    case CEC::CEC_OPCODE_USER_CONTROL_RELEASE:          return "user control release";
+    case CEC::CEC_OPCODE_GIVE_OSD_NAME:                 return "give osd name";
+    case CEC::CEC_OPCODE_SET_OSD_NAME:                  return "set osd name";
+    case CEC::CEC_OPCODE_SYSTEM_AUDIO_MODE_REQUEST:     return "system audio mode request";
+    case CEC::CEC_OPCODE_GIVE_AUDIO_STATUS:             return "give audio status";
+    case CEC::CEC_OPCODE_SET_SYSTEM_AUDIO_MODE:         return "set system audio mode";
+    case CEC::CEC_OPCODE_REPORT_AUDIO_STATUS:           return "report audio status";
+    case CEC::CEC_OPCODE_GIVE_SYSTEM_AUDIO_MODE_STATUS: return "give system audio mode status";
+    case CEC::CEC_OPCODE_SYSTEM_AUDIO_MODE_STATUS:      return "system audio mode status";
+    case CEC::CEC_OPCODE_ROUTING_CHANGE:                return "routing change";
+    case CEC::CEC_OPCODE_ROUTING_INFORMATION:           return "routing information";
+    case CEC::CEC_OPCODE_ACTIVE_SOURCE:                 return "active source";
+    case CEC::CEC_OPCODE_GIVE_PHYSICAL_ADDRESS:         return "give physical address";
+    case CEC::CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:       return "report physical address";
+    case CEC::CEC_OPCODE_REQUEST_ACTIVE_SOURCE:         return "request active source";
+    case CEC::CEC_OPCODE_SET_STREAM_PATH:               return "set stream path";
+    case CEC::CEC_OPCODE_DEVICE_VENDOR_ID:              return "device vendor id";
+    case CEC::CEC_OPCODE_VENDOR_COMMAND:                return "vendor command";
+    case CEC::CEC_OPCODE_GIVE_DEVICE_VENDOR_ID:         return "give device vendor id";
+    case CEC::CEC_OPCODE_MENU_REQUEST:                  return "menu request";
+    case CEC::CEC_OPCODE_MENU_STATUS:                   return "menu status";
+    case CEC::CEC_OPCODE_GIVE_DEVICE_POWER_STATUS:      return "give device power status";
+    case CEC::CEC_OPCODE_REPORT_POWER_STATUS:           return "report power status";
+    case CEC::CEC_OPCODE_GET_MENU_LANGUAGE:             return "get menu language";
+    case CEC::CEC_OPCODE_INACTIVE_SOURCE:               return "inactive source";
+    case CEC::CEC_OPCODE_CEC_VERSION:                   return "cec version";
+    case CEC::CEC_OPCODE_GET_CEC_VERSION:               return "get cec version";
+    case CEC::CEC_OPCODE_VENDOR_COMMAND_WITH_ID:        return "vendor command with id";
+    case CEC::CEC_OPCODE_REPORT_SHORT_AUDIO_DESCRIPTORS: return "report short audio descriptors";
+    case CEC::CEC_OPCODE_REQUEST_SHORT_AUDIO_DESCRIPTORS: return "request short audio descriptors";
+    case CEC::CEC_OPCODE_ABORT:                         return "abort";
+    default:                                            return "unknown";
+    }
+}
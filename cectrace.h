@@ -0,0 +1,71 @@
+#ifndef CECTRACE_H
+#define CECTRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include <libcec/cec.h>
+
+//  CEC flight recorder
+//
+//  Every received and transmitted cec_command is appended as a fixed-size binary
+//  record to a memory-mapped circular file. Recording is a clock read, one atomic
+//  increment and a 32 byte store, so it is left on in production. The file survives
+//  a crash and is decoded with "tvcec --dump-trace <file>".
+class CECTrace
+{
+public:
+    enum Direction : uint8_t
+    {
+        Received = 0,
+        Transmitted = 1
+    };
+
+    struct Record
+    {
+        uint64_t    timestamp;                  // CLOCK_MONOTONIC nanoseconds
+        uint32_t    seq;                        // Low 32 bits of position + 1, written last
+        uint8_t     direction;                  // Direction
+        uint8_t     initiator;                  // Initiator logical address
+        uint8_t     destination;                // Destination logical address
+        uint8_t     opcode;                     // Opcode (valid if opcode_set)
+        uint8_t     opcode_set;                 // Opcode present
+        uint8_t     size;                       // Number of parameter bytes
+        uint8_t     data[14];                   // Parameter bytes
+    };
+
+private:
+    struct Header
+    {
+        char                    magic[8];       // "TVCECTR1"
+        uint32_t                version;        // File version
+        uint32_t                record_size;    // sizeof(Record)
+        uint32_t                capacity;       // Number of records in ring
+        uint32_t                reserved;
+        int64_t                 wall_offset;    // CLOCK_REALTIME - CLOCK_MONOTONIC at last open (ns)
+        std::atomic<uint64_t>   head;           // Records ever written
+        char                    pad[24];
+    };
+
+    Header                      *header_;       // Mapped header or null
+    Record                      *records_;      // Mapped record ring
+    size_t                      map_size_;      // Mapped length
+    uint32_t                    mask_;          // capacity - 1
+
+public:
+    CECTrace();
+    ~CECTrace();
+
+    bool open(const char *filename, uint32_t capacity = 65536);
+    void close();
+    bool isOpen() const { return header_ != nullptr; }
+
+    void record(Direction direction, const CEC::cec_command &command);
+
+    static bool read(const char *filename, std::vector<Record> &records, int64_t *wallOffset = nullptr);
+    static int dump(const char *filename, FILE *out);
+    static const char *opcodeName(uint8_t opcode);
+};
+
+#endif // CECTRACE_H
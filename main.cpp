@@ -1,7 +1,12 @@
 #include <QCoreApplication>
+#include <QTimer>
+#include "captureserver.h"
+#include "cecreplay.h"
 #include "tvcec.h"
+#include "tvcecconfig.h"
 #include <iostream>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 
 void handle_signal(int signal)
@@ -12,6 +17,13 @@ void handle_signal(int signal)
 int main(int argc, char *argv[])
 {
     int ret =  1;
+
+    //  Decode a flight recorder file and exit
+    if (argc > 1 && strcmp(argv[1], "--dump-trace") == 0)
+    {
+        return CECTrace::dump(argc > 2 ? argv[2] : "tvcec.trace", stdout);
+    }
+
     QCoreApplication a(argc, argv);
 
     // Install the ctrl-C signal handler
@@ -21,17 +33,36 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    QString remote("tvremote.local");
+    QStringList remotes;
+    QStringList adapters;
+    const char *configfile = nullptr;
     TVCEC *tvcec = new TVCEC();
     uint32_t log = CEC::CEC_LOG_ERROR;
+    bool logset = false;
     char *logfile = nullptr;
     uint16_t logmask = 0xff;
+    size_t logsize = 1024;
+    size_t logtotal = 4096;
+    const char *tracefile = "tvcec.trace";
+    const char *adaptercache = "tvcec.adapter";
+    const char *statefile = "tvcec.state";
+    uint32_t tracesize = 65536;
+    VolumeCoalescer::Mode vmode = VolumeCoalescer::Hold;
+    int vwindow = 300;
+    int vpredict = 0;
+    int metricsport = 0;
+    const char *replayfile = nullptr;
+    double replayspeed = 1.0;
+    const char *capturefile = nullptr;
+    bool cbor = true;
+    int keyrepeat = 400;
+    int keywatchdog = 1000;
     for (int ii = 1; ii < argc; ii++)
     {
-        if (strcmp(argv[ii], "-dw") == 0) log |= CEC::CEC_LOG_WARNING;
-        if (strcmp(argv[ii], "-dn") == 0) log |= CEC::CEC_LOG_NOTICE;
-        if (strcmp(argv[ii], "-dt") == 0) log |= CEC::CEC_LOG_TRAFFIC;
-        if (strcmp(argv[ii], "-da") == 0) log |= CEC::CEC_LOG_ALL;
+        if (strcmp(argv[ii], "-dw") == 0) {log |= CEC::CEC_LOG_WARNING; logset = true;}
+        if (strcmp(argv[ii], "-dn") == 0) {log |= CEC::CEC_LOG_NOTICE; logset = true;}
+        if (strcmp(argv[ii], "-dt") == 0) {log |= CEC::CEC_LOG_TRAFFIC; logset = true;}
+        if (strcmp(argv[ii], "-da") == 0) {log |= CEC::CEC_LOG_ALL; logset = true;}
 
         if (strcmp(argv[ii], "-11") == 0) {if (logmask == 0xff) logmask = 0; logmask |= 1;}
         if (strcmp(argv[ii], "-l2") == 0) {if (logmask == 0xff) logmask = 0; logmask |= 2;}
@@ -41,18 +72,215 @@ int main(int argc, char *argv[])
         {
             logfile = argv[++ii];
         }
-        else if (argv[ii][0] != '-') remote = argv[ii];
+        else if (strcmp(argv[ii], "-logsize") == 0 && ii + 1 < argc)
+        {
+            logsize = strtoul(argv[++ii], nullptr, 10);
+        }
+        else if (strcmp(argv[ii], "-logtotal") == 0 && ii + 1 < argc)
+        {
+            logtotal = strtoul(argv[++ii], nullptr, 10);
+        }
+        else if (strcmp(argv[ii], "-trace") == 0 && ii + 1 < argc)
+        {
+            tracefile = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-tracesize") == 0 && ii + 1 < argc)
+        {
+            tracesize = strtoul(argv[++ii], nullptr, 10);
+        }
+        else if (strcmp(argv[ii], "-notrace") == 0)
+        {
+            tracefile = nullptr;
+        }
+        else if (strcmp(argv[ii], "-adaptercache") == 0 && ii + 1 < argc)
+        {
+            adaptercache = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-adapter") == 0 && ii + 1 < argc)
+        {
+            adapters << argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-noadaptercache") == 0)
+        {
+            adaptercache = nullptr;
+        }
+        else if (strcmp(argv[ii], "-state") == 0 && ii + 1 < argc)
+        {
+            statefile = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-nostate") == 0)
+        {
+            statefile = nullptr;
+        }
+        else if (strcmp(argv[ii], "-vwindow") == 0 && ii + 1 < argc)
+        {
+            vwindow = atoi(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-vpredict") == 0 && ii + 1 < argc)
+        {
+            vpredict = atoi(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-vstep") == 0)
+        {
+            vmode = VolumeCoalescer::Step;
+        }
+        else if (strcmp(argv[ii], "-metrics") == 0 && ii + 1 < argc)
+        {
+            metricsport = atoi(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-replay") == 0 && ii + 1 < argc)
+        {
+            replayfile = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-speed") == 0 && ii + 1 < argc)
+        {
+            replayspeed = atof(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-capture") == 0 && ii + 1 < argc)
+        {
+            capturefile = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-krepeat") == 0 && ii + 1 < argc)
+        {
+            keyrepeat = atoi(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-kwatchdog") == 0 && ii + 1 < argc)
+        {
+            keywatchdog = atoi(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-nocbor") == 0)
+        {
+            cbor = false;
+        }
+        else if (strcmp(argv[ii], "-config") == 0 && ii + 1 < argc)
+        {
+            configfile = argv[++ii];
+        }
+        else if (argv[ii][0] != '-') remotes << argv[ii];
+    }
+    TVCECConfig config;
+    if (configfile)
+    {
+        QString error;
+        if (!config.load(configfile, &error))
+        {
+            std::cerr << "Config file: " << qPrintable(error) << std::endl;
+            delete tvcec;
+            return 1;
+        }
     }
-    tvcec->setLogLevel(static_cast<CEC::cec_log_level>(log));
-    tvcec->setRemote(remote);
-    tvcec->setLogFile(logfile);
-    tvcec->setLogMask(logmask);
+
+    //  Replay a recorded trace in place of the CEC adapter and capture what is sent
+    CECReplayAdapter *replay = nullptr;
+    CaptureServer *capture = nullptr;
+    FILE *captureout = stdout;
+    if (replayfile)
+    {
+        replay = new CECReplayAdapter(replayspeed);
+        if (!replay->load(replayfile))
+        {
+            delete replay;
+            delete tvcec;
+            return 1;
+        }
+        if (capturefile && (captureout = fopen(capturefile, "w")) == nullptr)
+        {
+            std::cerr << "Cannot open capture file " << capturefile << std::endl;
+            delete replay;
+            delete tvcec;
+            return 1;
+        }
+        capture = new CaptureServer(captureout, cbor);
+        if (!capture->listen())
+        {
+            std::cerr << "Cannot start the capture server" << std::endl;
+            delete capture;
+            delete replay;
+            delete tvcec;
+            return 1;
+        }
+        remotes.clear();
+        remotes << QString("127.0.0.1:%1").arg(capture->port());
+        tracefile = nullptr;
+        adaptercache = nullptr;
+        statefile = nullptr;
+        adapters.clear();
+
+        //  Give the last messages time to arrive before quitting
+        replay->setFinished([]()
+        {
+            QMetaObject::invokeMethod(qApp, []() {QTimer::singleShot(1000, qApp, &QCoreApplication::quit);},
+                                      Qt::QueuedConnection);
+        });
+        tvcec->setAdapter(replay);
+    }
+
+    //  Settings given on the command line win over the config file, also on reload
+    auto override = [&](TVCECConfig &cfg)
+    {
+        if (logset) cfg.logLevel = log;
+        if (logmask != 0xff) cfg.logMask = logmask;
+        if (logfile) cfg.logFile = logfile;
+        if (!remotes.isEmpty()) cfg.remotes = remotes;
+        if (!adapters.isEmpty() || replay) cfg.adapters = adapters;
+        if (cfg.remotes.isEmpty()) cfg.remotes << "tvremote.local";
+    };
+    override(config);
+    tvcec->setAdapterPorts(config.adapters);
+    tvcec->setAdapterCache(adaptercache);
+    tvcec->setCborAllowed(cbor);
+    tvcec->applyConfig(config);
+    tvcec->setLogRotation(logsize * 1024, logtotal * 1024);
+    tvcec->setVolumeCoalescing(vmode, vwindow);
+    tvcec->setVolumePrediction(vpredict);
+    tvcec->setKeyRepeat(keyrepeat, keywatchdog);
+    if (tracefile && !tvcec->setTraceFile(tracefile, tracesize))
+    {
+        std::cerr << "Failed to open trace file " << tracefile << std::endl;
+    }
+    tvcec->setMetricsPort(metricsport);
+    if (statefile && !tvcec->setStateFile(statefile))
+    {
+        std::cerr << "Failed to open state file " << statefile << std::endl;
+    }
+
+    //  Reread the config file on SIGHUP or when it is saved; the CEC adapters stay
+    //  open. Without a file SIGHUP reapplies the command line, reopening the log.
+    TVCECConfigWatcher *watcher = new TVCECConfigWatcher(configfile ? configfile : "");
+    QObject::connect(watcher, &TVCECConfigWatcher::reload, tvcec, [&]()
+    {
+        TVCECConfig reloaded;
+        QString error;
+        if (configfile && !reloaded.load(configfile, &error))
+        {
+            CECLOG(tvcec->logger(), General, Error, "Config file not reloaded: %s", qPrintable(error));
+            return;
+        }
+        override(reloaded);
+        if (reloaded.adapters != config.adapters)
+        {
+            CECLOG(tvcec->logger(), General, Warn, "CEC adapter changes take effect on restart");
+        }
+        tvcec->applyConfig(reloaded);
+    });
+
     if (tvcec->init())
     {
         ret = a.exec();
     }
+    if (replay)
+    {
+        std::cerr << "Replayed " << replay->delivered() << " of " << replay->frames() << " records, " <<
+                     replay->transmitted() << " frames sent, " << capture->count() << " messages captured" << std::endl;
+    }
 
+    delete watcher;
     delete tvcec;
+    delete capture;
+    if (captureout != stdout)
+    {
+        fclose(captureout);
+    }
 
     return ret;
 }
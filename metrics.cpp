@@ -0,0 +1,155 @@
+#include "metrics.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QVariant>
+#include <stdio.h>
+
+const int64_t Histogram::bounds_[kBuckets] =
+{
+    100000LL, 250000LL, 500000LL,
+    1000000LL, 2500000LL, 5000000LL,
+    10000000LL, 25000000LL, 50000000LL,
+    100000000LL, 250000000LL, 500000000LL,
+    1000000000LL, 2500000000LL, 5000000000LL,
+    INT64_MAX
+};
+
+Histogram::Histogram() : count_(0), sum_(0)
+{
+    for (int ii = 0; ii < kBuckets; ii++)
+    {
+        buckets_[ii].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(int64_t nsec)
+{
+    if (nsec < 0)
+    {
+        nsec = 0;
+    }
+    int ii = 0;
+    while (nsec > bounds_[ii])
+    {
+        ii++;
+    }
+    buckets_[ii].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(nsec, std::memory_order_relaxed);
+}
+
+void Histogram::render(QByteArray &out, const char *name, const char *labels) const
+{
+    QByteArray lbl = labels ? QByteArray(labels) + "," : QByteArray();
+    uint64_t cumulative = 0;
+    for (int ii = 0; ii < kBuckets; ii++)
+    {
+        cumulative += buckets_[ii].load(std::memory_order_relaxed);
+        QByteArray le = ii < kBuckets - 1 ? QByteArray::number(bounds_[ii] / 1e9, 'g', 6) : QByteArray("+Inf");
+        out += QByteArray(name) + "_bucket{" + lbl + "le=\"" + le + "\"} " + QByteArray::number(cumulative) + "\n";
+    }
+    QByteArray suffix = labels ? "{" + QByteArray(labels) + "}" : QByteArray();
+    out += QByteArray(name) + "_sum" + suffix + " " + QByteArray::number(sum_.load(std::memory_order_relaxed) / 1e9, 'g', 9) + "\n";
+    out += QByteArray(name) + "_count" + suffix + " " + QByteArray::number(count_.load(std::memory_order_relaxed)) + "\n";
+}
+
+static void renderCounter(QByteArray &out, const char *name, const char *help, const Counter &counter)
+{
+    out += QByteArray("# HELP ") + name + " " + help + "\n# TYPE " + name + " counter\n";
+    out += QByteArray(name) + " " + QByteArray::number(counter.value()) + "\n";
+}
+
+static void renderGauge(QByteArray &out, const char *name, const char *help, const Gauge &gauge)
+{
+    out += QByteArray("# HELP ") + name + " " + help + "\n# TYPE " + name + " gauge\n";
+    out += QByteArray(name) + " " + QByteArray::number(static_cast<qint64>(gauge.value())) + "\n";
+}
+
+static void renderHistogram(QByteArray &out, const char *name, const char *help, const Histogram &hist)
+{
+    out += QByteArray("# HELP ") + name + " " + help + "\n# TYPE " + name + " histogram\n";
+    hist.render(out, name);
+}
+
+QByteArray Metrics::render() const
+{
+    QByteArray out;
+    out.reserve(16384);
+    renderHistogram(out, "tvcec_cec_to_ws_seconds", "CEC frame received to websocket send", cec_to_ws);
+    renderHistogram(out, "tvcec_queue_residency_seconds", "Time a message waited in an outbound queue", queue_residency);
+    renderHistogram(out, "tvcec_ws_rtt_seconds", "Websocket ping round trip time", ws_rtt);
+    renderHistogram(out, "tvcec_cec_queue_wait_seconds", "libcec callback to CEC worker thread", cec_queue_wait);
+    renderHistogram(out, "tvcec_key_repeat_jitter_seconds", "Held key repeat deviation from its schedule", key_repeat_jitter);
+
+    out += "# HELP tvcec_command_handler_seconds CEC frame processing time by opcode\n"
+           "# TYPE tvcec_command_handler_seconds histogram\n";
+    for (int ii = 0; ii < 256; ii++)
+    {
+        if (handler[ii].count() > 0)
+        {
+            char labels[24];
+            snprintf(labels, sizeof(labels), "opcode=\"0x%02x\"", ii);
+            handler[ii].render(out, "tvcec_command_handler_seconds", labels);
+        }
+    }
+
+    renderCounter(out, "tvcec_cec_rx_total", "CEC frames received", cec_rx);
+    renderCounter(out, "tvcec_cec_tx_total", "CEC frames transmitted", cec_tx);
+    renderCounter(out, "tvcec_ws_sent_total", "Websocket messages sent", ws_sent);
+    renderCounter(out, "tvcec_ws_liveness_failures_total", "Websocket links closed for unanswered pings", ws_liveness_failures);
+    renderCounter(out, "tvcec_queue_dropped_total", "Messages evicted from a full outbound queue", queue_dropped);
+    renderCounter(out, "tvcec_queue_expired_total", "Messages expired in an outbound queue", queue_expired);
+    renderCounter(out, "tvcec_queue_replaced_total", "Queued state messages replaced by newer state", queue_replaced);
+    renderCounter(out, "tvcec_cec_queue_dropped_total", "CEC events lost to a full worker queue", cec_queue_dropped);
+    renderCounter(out, "tvcec_key_repeats_total", "Held key repeats transmitted", key_repeats);
+    renderCounter(out, "tvcec_key_forced_release_total", "Held keys released by the watchdog", key_forced_release);
+    renderGauge(out, "tvcec_cec_queue_depth", "CEC events waiting for the worker thread", cec_queue_depth);
+    renderGauge(out, "tvcec_cec_queue_high", "Deepest CEC event backlog seen", cec_queue_high);
+    return out;
+}
+
+MetricsServer::MetricsServer(const Metrics *metrics, QObject *parent) : QObject{parent}, metrics_(metrics)
+{
+    server_ = new QTcpServer(this);
+    connect(server_, &QTcpServer::newConnection, this, &MetricsServer::newConnection);
+}
+
+bool MetricsServer::listen(quint16 port)
+{
+    return server_->listen(QHostAddress::Any, port);
+}
+
+void MetricsServer::newConnection()
+{
+    while (QTcpSocket *sock = server_->nextPendingConnection())
+    {
+        connect(sock, &QTcpSocket::disconnected, sock, &QObject::deleteLater);
+        connect(sock, &QTcpSocket::readyRead, this, [this, sock]()
+        {
+            //  Wait for the end of the request headers
+            if (!sock->canReadLine() || sock->property("answered").toBool())
+            {
+                return;
+            }
+            QByteArray request = sock->readLine();
+            sock->readAll();
+            sock->setProperty("answered", true);
+
+            QByteArray body;
+            QByteArray status;
+            if (request.startsWith("GET /metrics ") || request.startsWith("GET / "))
+            {
+                status = "200 OK";
+                body = metrics_->render();
+            }
+            else
+            {
+                status = "404 Not Found";
+                body = "not found\n";
+            }
+            sock->write("HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                        QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+            sock->disconnectFromHost();
+        });
+    }
+}
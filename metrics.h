@@ -0,0 +1,100 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <QByteArray>
+#include <QObject>
+
+class QTcpServer;
+
+//  Fixed bucket latency histogram; observe() is a few relaxed atomic adds
+class Histogram
+{
+public:
+    static const int    kBuckets = 16;
+
+private:
+    static const int64_t    bounds_[kBuckets];  // Upper bounds (nsec), last is +Inf
+    std::atomic<uint64_t>   buckets_[kBuckets];
+    std::atomic<uint64_t>   count_;
+    std::atomic<uint64_t>   sum_;               // nsec
+
+public:
+    Histogram();
+
+    void observe(int64_t nsec);
+    uint64_t count() const {return count_.load(std::memory_order_relaxed);}
+    void render(QByteArray &out, const char *name, const char *labels = nullptr) const;
+};
+
+class Counter
+{
+private:
+    std::atomic<uint64_t>   value_;
+
+public:
+    Counter() : value_(0) {}
+
+    void add(uint64_t n = 1) {value_.fetch_add(n, std::memory_order_relaxed);}
+    uint64_t value() const {return value_.load(std::memory_order_relaxed);}
+};
+
+class Gauge
+{
+private:
+    std::atomic<int64_t>    value_;
+
+public:
+    Gauge() : value_(0) {}
+
+    void set(int64_t value) {value_.store(value, std::memory_order_relaxed);}
+    int64_t value() const {return value_.load(std::memory_order_relaxed);}
+};
+
+//  Process metrics rendered in Prometheus text format
+struct Metrics
+{
+    Histogram           cec_to_ws;              // CEC frame received to websocket send
+    Histogram           queue_residency;        // Time in an outbound queue
+    Histogram           ws_rtt;                 // Websocket ping round trip
+    Histogram           handler[256];           // CEC frame processing time per opcode
+    Histogram           cec_queue_wait;         // libcec callback to worker thread
+    Histogram           key_repeat_jitter;      // Held key repeat sent later or earlier than scheduled
+
+    Counter             cec_rx;                 // CEC frames received
+    Counter             cec_tx;                 // CEC frames transmitted
+    Counter             ws_sent;                // Websocket messages sent
+    Counter             ws_liveness_failures;   // Links closed for unanswered pings
+    Counter             queue_dropped;          // Evicted from a full queue
+    Counter             queue_expired;          // Past deadline
+    Counter             queue_replaced;         // Replaced by newer state
+    Counter             cec_queue_dropped;      // CEC events lost to a full worker queue
+    Counter             key_repeats;            // Held key repeats transmitted
+    Counter             key_forced_release;     // Held keys released by the watchdog
+
+    Gauge               cec_queue_depth;        // CEC events waiting for the worker
+    Gauge               cec_queue_high;         // Deepest CEC event backlog seen
+
+    QByteArray render() const;
+};
+
+//  Minimal HTTP listener serving GET /metrics
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+
+private:
+    const Metrics       *metrics_;
+    QTcpServer          *server_;
+
+public:
+    explicit MetricsServer(const Metrics *metrics, QObject *parent = nullptr);
+
+    bool listen(quint16 port);
+
+private slots:
+    void newConnection();
+};
+
+#endif // METRICS_H
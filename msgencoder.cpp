@@ -0,0 +1,227 @@
+#include "msgencoder.h"
+#include <string.h>
+
+MsgEncoder &MsgEncoder::raw(const char *text, size_t len)
+{
+    if (ok_ && out_.len + len < MsgBuffer::kSize)
+    {
+        memcpy(out_.data + out_.len, text, len);
+        out_.len += len;
+    }
+    else
+    {
+        ok_ = false;
+    }
+    return *this;
+}
+
+MsgEncoder &MsgEncoder::str(const char *text)
+{
+    //  JSON string escaping as done by QJsonDocument
+    static const char hex[] = "0123456789abcdef";
+    for (const unsigned char *cp = reinterpret_cast<const unsigned char *>(text); *cp && ok_; cp++)
+    {
+        char esc[6];
+        switch (*cp)
+        {
+        case '"':  raw("\\\"", 2); break;
+        case '\\': raw("\\\\", 2); break;
+        case '\b': raw("\\b", 2); break;
+        case '\f': raw("\\f", 2); break;
+        case '\n': raw("\\n", 2); break;
+        case '\r': raw("\\r", 2); break;
+        case '\t': raw("\\t", 2); break;
+        default:
+            if (*cp < 0x20)
+            {
+                memcpy(esc, "\\u00", 4);
+                esc[4] = hex[*cp >> 4];
+                esc[5] = hex[*cp & 0xf];
+                raw(esc, 6);
+            }
+            else
+            {
+                raw(reinterpret_cast<const char *>(cp), 1);
+            }
+            break;
+        }
+    }
+    return *this;
+}
+
+MsgEncoder &MsgEncoder::num(int value)
+{
+    char buf[12];
+    char *cp = buf + sizeof(buf);
+    unsigned int uval = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+    do
+    {
+        *--cp = '0' + uval % 10;
+        uval /= 10;
+    } while (uval != 0);
+    if (value < 0)
+    {
+        *--cp = '-';
+    }
+    return raw(cp, buf + sizeof(buf) - cp);
+}
+
+MsgEncoder &MsgEncoder::head(uint8_t major, uint32_t value)
+{
+    //  CBOR initial byte and argument (RFC 8949 3.1)
+    char buf[5];
+    size_t len;
+    if (value < 24)
+    {
+        buf[0] = static_cast<char>((major << 5) | value);
+        len = 1;
+    }
+    else if (value < 0x100)
+    {
+        buf[0] = static_cast<char>((major << 5) | 24);
+        buf[1] = static_cast<char>(value);
+        len = 2;
+    }
+    else if (value < 0x10000)
+    {
+        buf[0] = static_cast<char>((major << 5) | 25);
+        buf[1] = static_cast<char>(value >> 8);
+        buf[2] = static_cast<char>(value);
+        len = 3;
+    }
+    else
+    {
+        buf[0] = static_cast<char>((major << 5) | 26);
+        buf[1] = static_cast<char>(value >> 24);
+        buf[2] = static_cast<char>(value >> 16);
+        buf[3] = static_cast<char>(value >> 8);
+        buf[4] = static_cast<char>(value);
+        len = 5;
+    }
+    return raw(buf, len);
+}
+
+MsgEncoder &MsgEncoder::cstr(const char *text)
+{
+    size_t len = strlen(text);
+    return head(3, len).raw(text, len);
+}
+
+MsgEncoder &MsgEncoder::cnum(int value)
+{
+    if (value < 0)
+    {
+        return head(1, static_cast<uint32_t>(-1 - value));
+    }
+    return head(0, static_cast<uint32_t>(value));
+}
+
+bool MsgEncoder::finish()
+{
+    if (!ok_)
+    {
+        out_.len = 0;
+    }
+    out_.data[out_.len] = 0;
+    return ok_;
+}
+
+bool MsgEncoder::buttonClick(MsgBuffer &out, const char *label, MsgBuffer::Format format)
+{
+    if (format == MsgBuffer::Cbor)
+    {
+        return MsgEncoder(out, format).map(3).ctext("button").cstr(label).ctext("func").ctext("tv_btn_click")
+                                      .ctext("path").ctext("/tvadapter").finish();
+    }
+    return MsgEncoder(out, format).lit("{\"button\":\"").str(label).lit("\",\"func\":\"tv_btn_click\",\"path\":\"/tvadapter\"}").finish();
+}
+
+bool MsgEncoder::buttonPress(MsgBuffer &out, const char *label, MsgBuffer::Format format)
+{
+    if (format == MsgBuffer::Cbor)
+    {
+        return MsgEncoder(out, format).map(3).ctext("button").cstr(label).ctext("func").ctext("tv_btn_press")
+                                      .ctext("path").ctext("/tvadapter").finish();
+    }
+    return MsgEncoder(out, format).lit("{\"button\":\"").str(label).lit("\",\"func\":\"tv_btn_press\",\"path\":\"/tvadapter\"}").finish();
+}
+
+bool MsgEncoder::buttonRelease(MsgBuffer &out, const char *label, MsgBuffer::Format format)
+{
+    if (format == MsgBuffer::Cbor)
+    {
+        return MsgEncoder(out, format).map(3).ctext("button").cstr(label).ctext("func").ctext("tv_btn_release")
+                                      .ctext("path").ctext("/tvadapter").finish();
+    }
+    return MsgEncoder(out, format).lit("{\"button\":\"").str(label).lit("\",\"func\":\"tv_btn_release\",\"path\":\"/tvadapter\"}").finish();
+}
+
+bool MsgEncoder::buttonStep(MsgBuffer &out, const char *label, int count, MsgBuffer::Format format)
+{
+    if (format == MsgBuffer::Cbor)
+    {
+        return MsgEncoder(out, format).map(4).ctext("button").cstr(label).ctext("count").cnum(count)
+                                      .ctext("func").ctext("tv_btn_step").ctext("path").ctext("/tvadapter").finish();
+    }
+    return MsgEncoder(out, format).lit("{\"button\":\"").str(label).lit("\",\"count\":").num(count)
+                                  .lit(",\"func\":\"tv_btn_step\",\"path\":\"/tvadapter\"}").finish();
+}
+
+bool MsgEncoder::inputSelect(MsgBuffer &out, int address, const char *osdname, MsgBuffer::Format format)
+{
+    if (format == MsgBuffer::Cbor)
+    {
+        return MsgEncoder(out, format).map(4).ctext("address").cnum(address).ctext("func").ctext("input_select")
+                                      .ctext("osdname").cstr(osdname).ctext("path").ctext("/tvadapter").finish();
+    }
+    return MsgEncoder(out, format).lit("{\"address\":").num(address).lit(",\"func\":\"input_select\",\"osdname\":\"").str(osdname)
+                                  .lit("\",\"path\":\"/tvadapter\"}").finish();
+}
+
+bool MsgEncoder::copy(MsgBuffer &out, const char *data, size_t len, MsgBuffer::Format format)
+{
+    return MsgEncoder(out, format).raw(data, len).finish();
+}
+
+bool MsgEncoder::tagAdapter(MsgBuffer &msg, int adapter)
+{
+    //  Adds "adapter" as the first field of an encoded map. The other fields keep
+    //  their order, so the result is not sorted by key ("active" sorts first);
+    //  receivers look fields up by name. The message is unchanged on failure
+    MsgBuffer field;
+    MsgEncoder enc(field, msg.format);
+    if (msg.format == MsgBuffer::Cbor)
+    {
+        uint8_t head = static_cast<uint8_t>(msg.data[0]);
+        if (msg.len == 0 || (head & 0xe0) != 0xa0 || (head & 0x1f) >= 23)
+        {
+            return false;
+        }
+        enc.ctext("adapter").cnum(adapter);
+    }
+    else
+    {
+        if (msg.len < 2 || msg.data[0] != '{')
+        {
+            return false;
+        }
+        enc.lit("\"adapter\":").num(adapter);
+        if (msg.data[1] != '}')
+        {
+            enc.lit(",");
+        }
+    }
+    if (!enc.finish() || msg.len + field.len >= MsgBuffer::kSize)
+    {
+        return false;
+    }
+    if (msg.format == MsgBuffer::Cbor)
+    {
+        msg.data[0] = static_cast<char>(msg.data[0] + 1);
+    }
+    memmove(msg.data + 1 + field.len, msg.data + 1, msg.len - 1);
+    memcpy(msg.data + 1, field.data, field.len);
+    msg.len += field.len;
+    msg.data[msg.len] = 0;
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef MSGENCODER_H
+#define MSGENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//  Fixed size message buffer, JSON text or CBOR (always NUL terminated)
+struct MsgBuffer
+{
+    static const size_t kSize = 512;
+
+    enum Format : uint8_t
+    {
+        Json,
+        Cbor
+    };
+
+    uint16_t            len;
+    Format              format;
+    char                data[kSize];
+
+    MsgBuffer() : len(0), format(Json) {data[0] = 0;}
+};
+
+//  Encoder for the outbound message kinds
+//
+//  Each kind is a prebuilt byte template with only the variable fields patched
+//  in, so the key path needs no QJsonObject, QJsonDocument or QString. The
+//  JSON output is byte for byte what QJsonDocument::Compact produced (keys
+//  sorted). The CBOR output is the same map with numbers as CBOR integers.
+class MsgEncoder
+{
+private:
+    MsgBuffer           &out_;
+    bool                ok_;
+
+    MsgEncoder &raw(const char *text, size_t len);
+    template <size_t N> MsgEncoder &lit(const char (&text)[N]) {return raw(text, N - 1);}
+    MsgEncoder &str(const char *text);
+    MsgEncoder &num(int value);
+
+    MsgEncoder &head(uint8_t major, uint32_t value);
+    MsgEncoder &map(uint32_t fields) {return head(5, fields);}
+    template <size_t N> MsgEncoder &ctext(const char (&text)[N]) {return head(3, N - 1).raw(text, N - 1);}
+    MsgEncoder &cstr(const char *text);
+    MsgEncoder &cnum(int value);
+    bool finish();
+
+    MsgEncoder(MsgBuffer &out, MsgBuffer::Format format) : out_(out), ok_(true) {out_.len = 0; out_.format = format;}
+
+public:
+    static bool buttonClick(MsgBuffer &out, const char *label, MsgBuffer::Format format = MsgBuffer::Json);
+    static bool buttonPress(MsgBuffer &out, const char *label, MsgBuffer::Format format = MsgBuffer::Json);
+    static bool buttonRelease(MsgBuffer &out, const char *label, MsgBuffer::Format format = MsgBuffer::Json);
+    static bool buttonStep(MsgBuffer &out, const char *label, int count, MsgBuffer::Format format = MsgBuffer::Json);
+    static bool inputSelect(MsgBuffer &out, int address, const char *osdname, MsgBuffer::Format format = MsgBuffer::Json);
+    static bool copy(MsgBuffer &out, const char *data, size_t len, MsgBuffer::Format format = MsgBuffer::Json);
+    static bool tagAdapter(MsgBuffer &msg, int adapter);
+};
+
+#endif // MSGENCODER_H
@@ -0,0 +1,203 @@
+#include "msgqueue.h"
+#include <string.h>
+
+MsgQueue::MsgQueue() : count_(0), replaced_(0), dropped_(0), expired_(0)
+{
+    deadline_[State] = 0;
+    deadline_[Control] = 5000;
+    deadline_[Telemetry] = 30000;
+    clear();
+}
+
+void MsgQueue::clear()
+{
+    for (int ii = 0; ii < kPriorities; ii++)
+    {
+        head_[ii] = tail_[ii] = -1;
+    }
+    for (int ii = 0; ii < kKeys; ii++)
+    {
+        keyed_[ii] = -1;
+    }
+    for (int ii = 0; ii < kCapacity; ii++)
+    {
+        entries_[ii].next = ii + 1 < kCapacity ? ii + 1 : -1;
+        entries_[ii].prev = -1;
+    }
+    free_ = 0;
+    count_ = 0;
+}
+
+void MsgQueue::setDeadline(Priority priority, int64_t msec)
+{
+    deadline_[priority] = msec;
+    for (int16_t idx = head_[priority]; idx >= 0; idx = entries_[idx].next)
+    {
+        Entry &ent = entries_[idx];
+        ent.deadline = msec > 0 ? ent.queued + msec * 1000000 : 0;
+    }
+}
+
+int MsgQueue::size(Priority priority) const
+{
+    int ret = 0;
+    for (int16_t idx = head_[priority]; idx >= 0; idx = entries_[idx].next)
+    {
+        ret++;
+    }
+    return ret;
+}
+
+void MsgQueue::unlink(int16_t idx)
+{
+    Entry &ent = entries_[idx];
+    if (ent.prev >= 0)
+    {
+        entries_[ent.prev].next = ent.next;
+    }
+    else
+    {
+        head_[ent.priority] = ent.next;
+    }
+    if (ent.next >= 0)
+    {
+        entries_[ent.next].prev = ent.prev;
+    }
+    else
+    {
+        tail_[ent.priority] = ent.prev;
+    }
+    if (ent.key != NoKey && keyed_[ent.key] == idx)
+    {
+        keyed_[ent.key] = -1;
+    }
+}
+
+void MsgQueue::release(int16_t idx)
+{
+    unlink(idx);
+    entries_[idx].next = free_;
+    entries_[idx].prev = -1;
+    free_ = idx;
+    count_--;
+}
+
+const MsgQueue::Entry *MsgQueue::push(Priority priority, Key key, const MsgBuffer &msg, int64_t now, int64_t origin)
+{
+    return insert(priority, key, msg, now, deadline_[priority] > 0 ? now + deadline_[priority] * 1000000 : 0, origin);
+}
+
+const MsgQueue::Entry *MsgQueue::insert(Priority priority, Key key, const MsgBuffer &msg, int64_t now, int64_t deadline,
+                                        int64_t origin)
+{
+    if (key != NoKey && keyed_[key] >= 0)
+    {
+        //  Newer state replaces the queued one
+        release(keyed_[key]);
+        replaced_++;
+    }
+    if (free_ < 0)
+    {
+        //  Full: evict the oldest entry of the least important class
+        for (int pri = kPriorities - 1; pri >= 0; pri--)
+        {
+            if (head_[pri] >= 0)
+            {
+                release(head_[pri]);
+                dropped_++;
+                break;
+            }
+        }
+    }
+
+    int16_t idx = free_;
+    Entry &ent = entries_[idx];
+    free_ = ent.next;
+    ent.queued = now;
+    ent.deadline = deadline;
+    ent.origin = origin;
+    ent.priority = priority;
+    ent.key = key;
+    memcpy(ent.msg.data, msg.data, msg.len + 1);
+    ent.msg.len = msg.len;
+    ent.msg.format = msg.format;
+
+    ent.next = -1;
+    ent.prev = tail_[priority];
+    if (tail_[priority] >= 0)
+    {
+        entries_[tail_[priority]].next = idx;
+    }
+    else
+    {
+        head_[priority] = idx;
+    }
+    tail_[priority] = idx;
+    if (key != NoKey)
+    {
+        keyed_[key] = idx;
+    }
+    count_++;
+    return &ent;
+}
+
+const MsgQueue::Entry *MsgQueue::front() const
+{
+    for (int pri = 0; pri < kPriorities; pri++)
+    {
+        if (head_[pri] >= 0)
+        {
+            return &entries_[head_[pri]];
+        }
+    }
+    return nullptr;
+}
+
+const MsgQueue::Entry *MsgQueue::next(const Entry *entry) const
+{
+    //  Queue order: the rest of the entry's class, then the lower classes
+    if (entry->next >= 0)
+    {
+        return &entries_[entry->next];
+    }
+    for (int pri = entry->priority + 1; pri < kPriorities; pri++)
+    {
+        if (head_[pri] >= 0)
+        {
+            return &entries_[head_[pri]];
+        }
+    }
+    return nullptr;
+}
+
+void MsgQueue::pop_front()
+{
+    for (int pri = 0; pri < kPriorities; pri++)
+    {
+        if (head_[pri] >= 0)
+        {
+            release(head_[pri]);
+            return;
+        }
+    }
+}
+
+const MsgQueue::Entry *MsgQueue::nextExpired(int64_t now) const
+{
+    //  Each class is in queue order with one lifetime, so only heads can expire first
+    for (int pri = 0; pri < kPriorities; pri++)
+    {
+        int16_t idx = head_[pri];
+        if (idx >= 0 && entries_[idx].deadline != 0 && entries_[idx].deadline <= now)
+        {
+            return &entries_[idx];
+        }
+    }
+    return nullptr;
+}
+
+void MsgQueue::removeExpired(const Entry *entry)
+{
+    release(static_cast<int16_t>(entry - entries_));
+    expired_++;
+}
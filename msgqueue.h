@@ -0,0 +1,100 @@
+#ifndef MSGQUEUE_H
+#define MSGQUEUE_H
+
+#include <stdint.h>
+#include "msgencoder.h"
+
+//  Bounded priority queue of outbound messages
+//
+//  Entries come from a fixed pool, so memory is bounded and queueing never
+//  allocates. Each priority class is a FIFO with its own deadline on the
+//  monotonic clock. A keyed message replaces the queued message with the same
+//  key, so after an outage only the latest state is waiting to be sent.
+class MsgQueue
+{
+public:
+    enum Priority
+    {
+        State = 0,                              // Current state (power, input)
+        Control,                                // Key events
+        Telemetry,                              // Replies and diagnostics
+        kPriorities
+    };
+
+    //  Power and input state are keyed per CEC adapter: adapter n uses the
+    //  base key plus 2n (see adapterKey)
+    enum Key
+    {
+        NoKey = 0,
+        PowerKey,
+        InputKey,
+        kKeys = 1 + 2 * 4                       // NoKey plus both keys for kAdapters
+    };
+
+    static const int    kAdapters = 4;          // Adapters with their own state keys
+    static_assert(kKeys == 1 + 2 * kAdapters, "MsgQueue keys must cover every adapter");
+
+    static Key adapterKey(Key key, int adapter)
+            {return key == NoKey || adapter <= 0 || adapter >= kAdapters ? key : static_cast<Key>(key + 2 * adapter);}
+
+    struct Entry
+    {
+        int64_t         queued;                 // Monotonic nsec when queued
+        int64_t         deadline;               // Monotonic nsec to expire, 0 never
+        int64_t         origin;                 // Monotonic nsec of the CEC frame behind it, 0 none
+        uint8_t         priority;               // Priority class
+        uint8_t         key;                    // Compaction key
+        int16_t         prev;                   // Links within class or free list
+        int16_t         next;
+        MsgBuffer       msg;                    // UTF-8 message
+    };
+
+    static const int    kCapacity = 64;
+
+private:
+    Entry               entries_[kCapacity];
+    int16_t             head_[kPriorities];     // Oldest entry per class
+    int16_t             tail_[kPriorities];     // Newest entry per class
+    int16_t             free_;                  // Free list
+    int16_t             keyed_[kKeys];          // Queued entry per key
+    int                 count_;                 // Entries in use
+    int64_t             deadline_[kPriorities]; // Lifetime per class (msec, 0 never)
+
+    int                 replaced_;              // Entries replaced by a newer keyed entry
+    int                 dropped_;               // Entries evicted by a full queue
+    int                 expired_;               // Entries past deadline
+
+    void unlink(int16_t idx);
+    void release(int16_t idx);
+    const Entry *insert(Priority priority, Key key, const MsgBuffer &msg, int64_t now, int64_t deadline, int64_t origin);
+
+public:
+    MsgQueue();
+
+    //  Queued entries of the class are restamped, keeping one lifetime per class
+    void setDeadline(Priority priority, int64_t msec);
+    int64_t deadline(Priority priority) const {return deadline_[priority];}
+
+    bool isEmpty() const {return count_ == 0;}
+    int size() const {return count_;}
+    int size(Priority priority) const;
+    int replaced() const {return replaced_;}
+    int dropped() const {return dropped_;}
+    int expired() const {return expired_;}
+
+    //  Times are monotonic nsec; deadlines are set in msec
+    const Entry *push(Priority priority, Key key, const MsgBuffer &msg, int64_t now, int64_t origin = 0);
+    const Entry *front() const;
+    const Entry *next(const Entry *entry) const;
+    void pop_front();
+
+    //  Requeue a message saved by an earlier run with its original times
+    const Entry *restore(Priority priority, Key key, const MsgBuffer &msg, int64_t queued, int64_t deadline)
+                {return insert(priority, key, msg, queued, deadline, 0);}
+
+    const Entry *nextExpired(int64_t now) const;
+    void removeExpired(const Entry *entry);
+    void clear();
+};
+
+#endif // MSGQUEUE_H
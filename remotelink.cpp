@@ -0,0 +1,563 @@
+#include "remotelink.h"
+#include "ceclog.h"
+#include "metrics.h"
+#include "monotonic.h"
+#include <QCborStreamReader>
+#include <QCborValue>
+#include <QJsonDocument>
+#include <QRandomGenerator>
+#include <QUrl>
+#include <stdlib.h>
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+#include <QWebSocketHandshakeOptions>
+#endif
+
+const char *const RemoteLink::kCborProtocol = "tvcec.cbor.v1";
+const char *const RemoteLink::kJsonProtocol = "tvcec.json.v1";
+
+RemoteLink::RemoteLink(CECLog *log, Metrics *metrics, QObject *parent) : QObject{parent}, log_(log), metrics_(metrics), port_(0), lookup_id_(-1),
+    state_(Idle), attempts_(0), backoff_min_(500), backoff_max_(30000), write_limit_(16384),
+    idle_interval_(30000), active_interval_(2000), srtt_(-1), rttvar_(0), probes_(0), ping_sent_(0), last_heard_(0),
+    last_traffic_(0), cbor_allowed_(true), cbor_(false)
+{
+    state_since_ = monotonicMs();
+    for (int ii = 0; ii < kStates; ii++)
+    {
+        state_time_[ii] = 0;
+    }
+
+    websocket_ = new QWebSocket("tvcec");
+    connect(websocket_, &QWebSocket::connected, this, &RemoteLink::ws_connected);
+    connect(websocket_, &QWebSocket::disconnected, this, &RemoteLink::ws_disconnected);
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    connect(websocket_, &QWebSocket::errorOccurred, this, &RemoteLink::ws_error);
+#else
+    connect(websocket_, qOverload<QAbstractSocket::SocketError>(&QWebSocket::error), this, &RemoteLink::ws_error);
+#endif
+    connect(websocket_, &QWebSocket::textFrameReceived, this, &RemoteLink::ws_textFrame);
+    connect(websocket_, &QWebSocket::binaryMessageReceived, this, &RemoteLink::ws_binaryMessage);
+    connect(websocket_, &QWebSocket::pong, this, &RemoteLink::ws_pong);
+    connect(websocket_, &QWebSocket::bytesWritten, this, &RemoteLink::flush);
+
+    backoff_timer_ = new QTimer(this);
+    backoff_timer_->setSingleShot(true);
+    connect(backoff_timer_, &QTimer::timeout, this, &RemoteLink::backoffTimeout);
+
+    connect_timer_ = new QTimer(this);
+    connect_timer_->setSingleShot(true);
+    connect_timer_->setInterval(5000);
+    connect(connect_timer_, &QTimer::timeout, this, &RemoteLink::connectTimeout);
+
+    ping_timer_ = new QTimer(this);
+    ping_timer_->setSingleShot(true);
+    connect(ping_timer_, &QTimer::timeout, this, &RemoteLink::pingTimeout);
+
+    probe_timer_ = new QTimer(this);
+    probe_timer_->setSingleShot(true);
+    probe_timer_->setTimerType(Qt::PreciseTimer);
+    connect(probe_timer_, &QTimer::timeout, this, &RemoteLink::probeTimeout);
+}
+
+RemoteLink::~RemoteLink()
+{
+    if (lookup_id_ >= 0)
+    {
+        QHostInfo::abortHostLookup(lookup_id_);
+    }
+    websocket_->disconnect(this);
+    delete websocket_;
+}
+
+void RemoteLink::setHost(const QString &host)
+{
+    //  host or host:port
+    QUrl url("ws://" + host);
+    host_ = url.host().isEmpty() ? host : url.host();
+    port_ = url.port() > 0 ? url.port() : 0;
+    address_.clear();
+}
+
+qint64 RemoteLink::timeInState(State state) const
+{
+    qint64 ret = state_time_[state];
+    if (state == state_)
+    {
+        ret += monotonicMs() - state_since_;
+    }
+    return ret;
+}
+
+QString RemoteLink::stateReport() const
+{
+    QString ret;
+    for (int ii = 0; ii < kStates; ii++)
+    {
+        ret += QString("%1%2 %3").arg(ii > 0 ? " " : "").arg(stateName(static_cast<State>(ii))).arg(timeInState(static_cast<State>(ii)));
+    }
+    return ret;
+}
+
+const char *RemoteLink::stateName(State state)
+{
+    switch (state)
+    {
+    case Idle:          return "idle";
+    case Resolving:     return "resolving";
+    case Connecting:    return "connecting";
+    case Open:          return "open";
+    case Backoff:       return "backoff";
+    default:            return "?";
+    }
+}
+
+void RemoteLink::setState(State state)
+{
+    if (state == state_)
+    {
+        return;
+    }
+    qint64 now = monotonicMs();
+    CECLOG(log_, Ws, Debug, "Remote %s: %s -> %s after %d msec", qPrintable(host_), stateName(state_), stateName(state),
+           static_cast<int>(now - state_since_));
+    state_time_[state_] += now - state_since_;
+    state_since_ = now;
+    state_ = state;
+}
+
+void RemoteLink::connectToRemote()
+{
+    //  Only one attempt in flight; backoff holds further attempts off
+    if (state_ != Idle || host_.isEmpty())
+    {
+        return;
+    }
+
+    if (address_.isNull() && !address_.setAddress(host_))
+    {
+        setState(Resolving);
+        lookup_id_ = QHostInfo::lookupHost(host_, this, &RemoteLink::lookedUp);
+        connect_timer_->start();
+    }
+    else
+    {
+        startConnect();
+    }
+}
+
+void RemoteLink::lookedUp(const QHostInfo &info)
+{
+    lookup_id_ = -1;
+    if (state_ != Resolving)
+    {
+        return;
+    }
+    connect_timer_->stop();
+    for (const QHostAddress &addr : info.addresses())
+    {
+        if (addr.protocol() == QAbstractSocket::IPv4Protocol || address_.isNull())
+        {
+            address_ = addr;
+        }
+    }
+    if (address_.isNull())
+    {
+        fail(qPrintable(info.errorString()));
+        return;
+    }
+    startConnect();
+}
+
+void RemoteLink::startConnect()
+{
+    QUrl url;
+    url.setScheme("ws");
+    url.setHost(address_.toString());
+    if (port_ > 0)
+    {
+        url.setPort(port_);
+    }
+    url.setPath("/tvcec");
+    setState(Connecting);
+    connect_timer_->start();
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    QWebSocketHandshakeOptions options;
+    if (cbor_allowed_)
+    {
+        options.setSubprotocols(QStringList() << kCborProtocol << kJsonProtocol);
+    }
+    websocket_->open(url, options);
+#else
+    websocket_->open(url);
+#endif
+}
+
+void RemoteLink::fail(const char *reason)
+{
+    connect_timer_->stop();
+    if (lookup_id_ >= 0)
+    {
+        QHostInfo::abortHostLookup(lookup_id_);
+        lookup_id_ = -1;
+    }
+
+    //  Full jitter exponential backoff
+    int cap = backoff_min_;
+    for (int ii = 0; ii < attempts_ && cap < backoff_max_; ii++)
+    {
+        cap *= 2;
+    }
+    if (cap > backoff_max_)
+    {
+        cap = backoff_max_;
+    }
+    int delay = backoff_min_ / 2 + QRandomGenerator::global()->bounded(cap - backoff_min_ / 2 + 1);
+    attempts_++;
+
+    //  Resolve again next time in case the remote moved; queue JSON until it says otherwise
+    address_.clear();
+    cbor_ = false;
+    CECLOG(log_, Ws, Info, "Remote %s: %s, retry %d in %d msec", qPrintable(host_), reason, attempts_, delay);
+    setState(Backoff);
+    backoff_timer_->start(delay);
+}
+
+void RemoteLink::close()
+{
+    if (state_ == Open || state_ == Connecting)
+    {
+        websocket_->close();
+    }
+}
+
+void RemoteLink::enqueue(const MsgBuffer &msg, MsgQueue::Priority priority, MsgQueue::Key key, int64_t origin)
+{
+    int dropped = queue_.dropped();
+    int replaced = queue_.replaced();
+    queue_.push(priority, key, msg, monotonicNs(), origin);
+    metrics_->queue_dropped.add(queue_.dropped() - dropped);
+    metrics_->queue_replaced.add(queue_.replaced() - replaced);
+}
+
+bool RemoteLink::flush()
+{
+    bool ret = true;
+
+    //  Delete expired messages
+    int64_t now = monotonicNs();
+    const MsgQueue::Entry *expired;
+    while ((expired = queue_.nextExpired(now)) != nullptr)
+    {
+        CECLOG(log_, Ws, Debug, "Remote %s: delete expired message %s queued %d msec", qPrintable(host_),
+               expired->msg.format == MsgBuffer::Json ? expired->msg.data : "(cbor)",
+               static_cast<int>((now - expired->queued) / 1000000));
+        queue_.removeExpired(expired);
+        metrics_->queue_expired.add();
+        ret = false;
+    }
+
+    if (state_ == Open)
+    {
+        //  Leave the rest queued while the socket is backed up; bytesWritten resumes
+        bool sent_any = false;
+        while (!queue_.isEmpty() && websocket_->bytesToWrite() < write_limit_)
+        {
+            //  QWebSocket only takes QString text frames; this is the one conversion left for JSON
+            const MsgQueue::Entry *ent = queue_.front();
+            const MsgBuffer &msg = ent->msg;
+            qint64 sts;
+            if (msg.format == MsgBuffer::Cbor)
+            {
+                sts = websocket_->sendBinaryMessage(QByteArray::fromRawData(msg.data, msg.len));
+            }
+            else
+            {
+                sts = websocket_->sendTextMessage(QString::fromUtf8(msg.data, msg.len));
+            }
+            int64_t sent = monotonicNs();
+            metrics_->ws_sent.add();
+            metrics_->queue_residency.observe(sent - ent->queued);
+            if (ent->origin != 0)
+            {
+                metrics_->cec_to_ws.observe(sent - ent->origin);
+            }
+            CECLOG(log_, Ws, Debug, "Sent %d bytes of %d to %s: %s", static_cast<int>(sts), msg.len, qPrintable(host_),
+                   msg.format == MsgBuffer::Json ? msg.data : "(cbor)");
+            queue_.pop_front();
+            sent_any = true;
+        }
+        if (sent_any)
+        {
+            //  Nothing acknowledges a message, so if the remote has been quiet for
+            //  longer than a ping timeout ask it now; its pong stands in for the ack
+            last_traffic_ = now;
+            if (now - last_heard_ > static_cast<int64_t>(rto()) * 1000000)
+            {
+                probe();
+            }
+            schedulePing();
+        }
+    }
+    else
+    {
+        //  No-op while a connect is in progress or backing off
+        connectToRemote();
+    }
+    return ret;
+}
+
+void RemoteLink::ws_connected()
+{
+    connect_timer_->stop();
+    attempts_ = 0;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    cbor_ = cbor_allowed_ && websocket_->subprotocol() == kCborProtocol;
+#endif
+    CECLOG(log_, Ws, Debug, "Remote %s: using %s", qPrintable(host_), cbor_ ? "CBOR" : "JSON");
+    setState(Open);
+    probes_ = 0;
+    ping_sent_ = 0;
+    last_heard_ = monotonicNs();
+    last_traffic_ = last_heard_;
+    schedulePing();
+    emit connected(this);
+}
+
+void RemoteLink::ws_disconnected()
+{
+    State prev = state_;
+    ping_timer_->stop();
+    probe_timer_->stop();
+    probes_ = 0;
+    ping_sent_ = 0;
+    if (prev == Open)
+    {
+        //  Lost an open link: first retry comes quickly
+        fail("disconnected");
+        emit disconnected(this);
+    }
+    else if (prev == Connecting)
+    {
+        fail("connect failed");
+    }
+}
+
+void RemoteLink::ws_error(QAbstractSocket::SocketError error)
+{
+    if (state_ == Connecting)
+    {
+        websocket_->abort();
+        if (state_ == Connecting)
+        {
+            fail(qPrintable(websocket_->errorString()));
+        }
+    }
+}
+
+void RemoteLink::ws_textFrame(const QString &frame, bool isLastFrame)
+{
+    CECLOG(log_, Ws, Debug, "Received from %s: %s", qPrintable(host_), qPrintable(frame));
+    heard();
+    last_traffic_ = last_heard_;
+    emit messageReceived(this, decodeJson(frame));
+}
+
+void RemoteLink::ws_binaryMessage(const QByteArray &message)
+{
+    CECLOG(log_, Ws, Debug, "Received %d bytes of CBOR from %s", message.size(), qPrintable(host_));
+    heard();
+    last_traffic_ = last_heard_;
+    emit messageReceived(this, decodeCbor(message));
+}
+
+QJsonObject RemoteLink::decodeJson(const QString &text)
+{
+    return QJsonDocument::fromJson(text.toUtf8()).object();
+}
+
+static QString readCborString(QCborStreamReader &reader)
+{
+    QString ret;
+    auto chunk = reader.readString();
+    while (chunk.status == QCborStreamReader::Ok)
+    {
+        ret += chunk.data;
+        chunk = reader.readString();
+    }
+    return ret;
+}
+
+QJsonObject RemoteLink::decodeCbor(const QByteArray &data)
+{
+    //  Remote messages are flat maps, read straight off the stream; anything nested
+    //  goes through QCborValue
+    QJsonObject obj;
+    QCborStreamReader reader(data);
+    if (!reader.isMap() || !reader.enterContainer())
+    {
+        return obj;
+    }
+    while (reader.lastError() == QCborError::NoError && reader.hasNext())
+    {
+        if (!reader.isString())
+        {
+            return QJsonObject();
+        }
+        QString key = readCborString(reader);
+        QJsonValue value;
+        switch (reader.type())
+        {
+        case QCborStreamReader::UnsignedInteger:
+        case QCborStreamReader::NegativeInteger:
+            value = static_cast<qint64>(reader.toInteger());
+            reader.next();
+            break;
+
+        case QCborStreamReader::String:
+            value = readCborString(reader);
+            break;
+
+        case QCborStreamReader::SimpleType:
+            if (reader.isBool())
+            {
+                value = reader.toBool();
+            }
+            reader.next();
+            break;
+
+        case QCborStreamReader::Float16:
+            value = static_cast<double>(static_cast<float>(reader.toFloat16()));
+            reader.next();
+            break;
+
+        case QCborStreamReader::Float:
+            value = static_cast<double>(reader.toFloat());
+            reader.next();
+            break;
+
+        case QCborStreamReader::Double:
+            value = reader.toDouble();
+            reader.next();
+            break;
+
+        default:
+            value = QCborValue::fromCbor(reader).toJsonValue();
+            break;
+        }
+        obj.insert(key, value);
+    }
+    return obj;
+}
+
+void RemoteLink::ws_pong(quint64 elapsedTime, const QByteArray &payload)
+{
+    //  Only time pongs to a ping that was not repeated, as TCP does (Karn)
+    int64_t now = monotonicNs();
+    if (ping_sent_ != 0 && probes_ == 0)
+    {
+        int rtt = static_cast<int>((now - ping_sent_) / 1000);
+        if (srtt_ < 0)
+        {
+            srtt_ = rtt;
+            rttvar_ = rtt / 2;
+        }
+        else
+        {
+            rttvar_ = (3 * rttvar_ + abs(srtt_ - rtt)) / 4;
+            srtt_ = (7 * srtt_ + rtt) / 8;
+        }
+        metrics_->ws_rtt.observe(now - ping_sent_);
+    }
+    ping_sent_ = 0;
+    heard();
+    schedulePing();
+    emit pong(this, elapsedTime);
+}
+
+int RemoteLink::rto() const
+{
+    //  RFC 6298 2.2/2.3 with 1 msec clock granularity; 1 s before the first sample
+    if (srtt_ < 0)
+    {
+        return 1000;
+    }
+    int rto = (srtt_ + qMax(1000, 4 * rttvar_)) / 1000;
+    return qBound(kMinRto, rto, kMaxRto);
+}
+
+void RemoteLink::heard()
+{
+    //  Anything from the remote shows it is alive
+    last_heard_ = monotonicNs();
+    probes_ = 0;
+    probe_timer_->stop();
+}
+
+void RemoteLink::probe()
+{
+    if (state_ != Open || probe_timer_->isActive())
+    {
+        return;
+    }
+    ping_sent_ = monotonicNs();
+    websocket_->ping();
+    probe_timer_->start(rto());
+}
+
+void RemoteLink::schedulePing()
+{
+    //  Frequent pings only while messages are flowing; an idle remote costs one ping per idle interval
+    if (state_ != Open)
+    {
+        return;
+    }
+    bool active = monotonicNs() - last_traffic_ < static_cast<int64_t>(kActiveWindow) * 1000000;
+    int interval = active ? active_interval_ : idle_interval_;
+    if (!ping_timer_->isActive() || ping_timer_->remainingTime() > interval)
+    {
+        ping_timer_->start(interval);
+    }
+}
+
+void RemoteLink::pingTimeout()
+{
+    probe();
+    schedulePing();
+}
+
+void RemoteLink::probeTimeout()
+{
+    probes_++;
+    if (probes_ >= kMaxProbes)
+    {
+        CECLOG(log_, Health, Warn, "Remote %s: %d pings unanswered (timeout %d msec, srtt %d usec), closing", qPrintable(host_),
+               probes_, rto(), srtt_);
+        metrics_->ws_liveness_failures.add();
+        websocket_->abort();
+        return;
+    }
+    ping_sent_ = monotonicNs();
+    websocket_->ping();
+    probe_timer_->start(rto());
+}
+
+void RemoteLink::connectTimeout()
+{
+    if (state_ == Resolving)
+    {
+        fail("lookup timed out");
+    }
+    else if (state_ == Connecting)
+    {
+        websocket_->abort();
+        if (state_ == Connecting)
+        {
+            fail("connect timed out");
+        }
+    }
+}
+
+void RemoteLink::backoffTimeout()
+{
+    setState(Idle);
+    connectToRemote();
+}
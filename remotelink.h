@@ -0,0 +1,153 @@
+#ifndef REMOTELINK_H
+#define REMOTELINK_H
+
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QJsonObject>
+#include <QObject>
+#include <QTimer>
+#include <QWebSocket>
+#include "msgqueue.h"
+
+class CECLog;
+struct Metrics;
+
+//  Websocket endpoint for one remote
+//
+//  An explicit state machine (idle, resolving, connecting, open, backoff)
+//  allows a single connect attempt at a time. Failed attempts back off
+//  exponentially with jitter so an unreachable remote costs little CPU and
+//  airtime. Time spent in each state is accumulated for reporting.
+//
+//  Each endpoint has its own outbound queue, liveness check and write
+//  backpressure so that a slow or dead remote never holds up another one.
+//
+//  Liveness follows TCP retransmission timing (RFC 6298): pings are timed out
+//  at srtt + 4 * rttvar from the measured round trips, and kMaxProbes missed in
+//  a row close the link. Pings are frequent while messages are flowing and rare
+//  when idle. Sending to a remote not heard from within one timeout probes it
+//  at once, so a dead remote is found within about a second of a key press.
+//
+//  With Qt 6.4 or later the CBOR subprotocol is offered on connect. A remote
+//  that selects it gets CBOR in binary frames; text frames are always JSON,
+//  and remotes that select nothing stay on JSON.
+class RemoteLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum State
+    {
+        Idle,
+        Resolving,
+        Connecting,
+        Open,
+        Backoff,
+        kStates
+    };
+
+private:
+    CECLog              *log_;                  // Logger
+    Metrics             *metrics_;              // Latency and queue metrics
+    QWebSocket          *websocket_;            // Websocket to remote
+    QString             host_;                  // Remote host name or address
+    quint16             port_;                  // Remote port (0 default)
+    QHostAddress        address_;               // Resolved address (cached until a connect fails)
+    int                 lookup_id_;             // Pending host lookup or -1
+
+    State               state_;                 // Connection state
+    qint64              state_since_;           // Monotonic msec state entered
+    qint64              state_time_[kStates];   // Accumulated msec per state
+    int                 attempts_;              // Consecutive failed attempts
+
+    QTimer              *backoff_timer_;        // Backoff delay
+    QTimer              *connect_timer_;        // Connect timeout
+    int                 backoff_min_;           // First backoff delay (msec)
+    int                 backoff_max_;           // Backoff delay cap (msec)
+
+    MsgQueue            queue_;                 // Outbound messages
+    qint64              write_limit_;           // Stop writing above this many unsent bytes
+    QTimer              *ping_timer_;           // Next routine ping
+    QTimer              *probe_timer_;          // Outstanding ping timeout
+    int                 idle_interval_;         // Ping interval with no recent traffic (msec)
+    int                 active_interval_;       // Ping interval while traffic is flowing (msec)
+    int                 srtt_;                  // Smoothed round trip (usec), -1 before the first sample
+    int                 rttvar_;                // Round trip variation (usec)
+    int                 probes_;                // Pings timed out in a row
+    int64_t             ping_sent_;             // Monotonic nsec of the outstanding ping, 0 none
+    int64_t             last_heard_;            // Monotonic nsec of the last frame or pong from the remote
+    int64_t             last_traffic_;          // Monotonic nsec of the last message either way
+
+    bool                cbor_allowed_;          // Offer the CBOR subprotocol
+    bool                cbor_;                  // Remote selected CBOR on this connection
+
+    void setState(State state);
+    void startConnect();
+    void fail(const char *reason);
+    void probe();
+    void heard();
+    void schedulePing();
+
+public:
+    RemoteLink(CECLog *log, Metrics *metrics, QObject *parent = nullptr);
+    virtual ~RemoteLink();
+
+    void setHost(const QString &host);
+    const QString &host() const {return host_;}
+    void setBackoff(int minMsec, int maxMsec) {backoff_min_ = minMsec; backoff_max_ = maxMsec;}
+    void setConnectTimeout(int msec) {connect_timer_->setInterval(msec);}
+    void setQueueDeadline(MsgQueue::Priority priority, int msec) {queue_.setDeadline(priority, msec);}
+    void setPingIntervals(int idleMsec, int activeMsec) {idle_interval_ = idleMsec; active_interval_ = activeMsec;}
+    int rto() const;
+    int srtt() const {return srtt_;}
+    void setCborAllowed(bool allowed) {cbor_allowed_ = allowed;}
+    bool isCbor() const {return cbor_;}
+    const MsgQueue &queue() const {return queue_;}
+
+    void enqueue(const MsgBuffer &msg, MsgQueue::Priority priority, MsgQueue::Key key, int64_t origin = 0);
+    void restore(const MsgBuffer &msg, MsgQueue::Priority priority, MsgQueue::Key key, int64_t queued, int64_t deadline)
+            {queue_.restore(priority, key, msg, queued, deadline);}
+
+    State state() const {return state_;}
+    bool isOpen() const {return state_ == Open;}
+    QWebSocket *socket() const {return websocket_;}
+    qint64 timeInState(State state) const;
+    QString stateReport() const;
+    static const char *stateName(State state);
+
+    static const int    kMaxProbes = 3;         // Missed pings that close the link
+    static const int    kMinRto = 200;          // Ping timeout bounds (msec)
+    static const int    kMaxRto = 2000;
+    static const int    kActiveWindow = 10000;  // Traffic this recent keeps pings frequent (msec)
+
+    static const char *const kCborProtocol;
+    static const char *const kJsonProtocol;
+    static QJsonObject decodeJson(const QString &text);
+    static QJsonObject decodeCbor(const QByteArray &data);
+
+public slots:
+    void connectToRemote();
+    void close();
+    bool flush();
+
+private slots:
+    void lookedUp(const QHostInfo &info);
+    void ws_connected();
+    void ws_disconnected();
+    void ws_error(QAbstractSocket::SocketError error);
+    void ws_textFrame(const QString &frame, bool isLastFrame);
+    void ws_binaryMessage(const QByteArray &message);
+    void ws_pong(quint64 elapsedTime, const QByteArray &payload);
+    void connectTimeout();
+    void backoffTimeout();
+    void pingTimeout();
+    void probeTimeout();
+
+signals:
+    void connected(RemoteLink *link);
+    void disconnected(RemoteLink *link);
+    void messageReceived(RemoteLink *link, const QJsonObject &msg);
+    void pong(RemoteLink *link, quint64 elapsedTime);
+};
+
+#endif // REMOTELINK_H
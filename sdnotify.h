@@ -0,0 +1,11 @@
+#ifndef SDNOTIFY_H
+#define SDNOTIFY_H
+
+//  systemd service notification (sd_notify protocol)
+//
+//  Sends state lines such as "READY=1" to the socket named by NOTIFY_SOCKET.
+//  Does nothing, and returns false, when not started by systemd with
+//  Type=notify. Written against the protocol so libsystemd is not needed.
+bool sdNotify(const char *state);
+
+#endif // SDNOTIFY_H
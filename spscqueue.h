@@ -0,0 +1,55 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+
+//  Bounded single producer, single consumer queue
+//
+//  Slots are preallocated; push and pop are a copy and one release store, and
+//  never block or allocate. Producer and consumer indexes sit on separate cache
+//  lines. Capacity must be a power of 2.
+template <typename T, uint32_t N>
+class SPSCQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SPSCQueue capacity must be a power of 2");
+
+private:
+    alignas(64) std::atomic<uint32_t>   head_;  // Next slot to write (producer)
+    alignas(64) std::atomic<uint32_t>   tail_;  // Next slot to read (consumer)
+    alignas(64) T                       slots_[N];
+
+public:
+    SPSCQueue() : head_(0), tail_(0) {}
+
+    //  Producer side; false if full
+    bool push(const T &item)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= N)
+        {
+            return false;
+        }
+        slots_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    //  Consumer side; false if empty
+    bool pop(T &item)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+        {
+            return false;
+        }
+        item = slots_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t size() const {return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);}
+    static constexpr uint32_t capacity() {return N;}
+};
+
+#endif // SPSCQUEUE_H
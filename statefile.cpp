@@ -0,0 +1,167 @@
+#include "statefile.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char   kStateMagic[8] = {'T', 'V', 'C', 'E', 'C', 'S', 'T', '1'};
+static const uint32_t kStateVersion = 1;
+
+StateFile::StateFile() : header_(nullptr), slots_(nullptr), map_size_(0), generation_(0), spare_(0)
+{
+    memset(boot_id_, 0, sizeof(boot_id_));
+    if (FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r"))
+    {
+        if (fgets(boot_id_, sizeof(boot_id_), fp))
+        {
+            boot_id_[strcspn(boot_id_, "\r\n")] = 0;
+        }
+        fclose(fp);
+    }
+}
+
+StateFile::~StateFile()
+{
+    close();
+}
+
+bool StateFile::open(const char *filename)
+{
+    close();
+
+    size_t size = sizeof(Header) + 2 * sizeof(Slot);
+    int fd = ::open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    //  A file of another layout is started afresh
+    bool reuse = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size)
+    {
+        Header hdr;
+        if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr))
+        {
+            reuse = memcmp(hdr.magic, kStateMagic, sizeof(kStateMagic)) == 0 && hdr.version == kStateVersion &&
+                    hdr.slot_size == sizeof(Slot);
+        }
+    }
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    header_ = static_cast<Header *>(map);
+    slots_ = reinterpret_cast<Slot *>(static_cast<char *>(map) + sizeof(Header));
+    map_size_ = size;
+    if (!reuse)
+    {
+        memcpy(header_->magic, kStateMagic, sizeof(kStateMagic));
+        header_->version = kStateVersion;
+        header_->slot_size = sizeof(Slot);
+    }
+
+    //  The next save overwrites the older slot, never the newest intact one
+    generation_ = 0;
+    spare_ = 0;
+    if (const Snapshot *snap = load())
+    {
+        const Slot *slot = reinterpret_cast<const Slot *>(reinterpret_cast<const char *>(snap) - offsetof(Slot, snap));
+        generation_ = slot->generation;
+        spare_ = slot == &slots_[0] ? 1 : 0;
+    }
+    return true;
+}
+
+void StateFile::close()
+{
+    if (header_)
+    {
+        munmap(header_, map_size_);
+        header_ = nullptr;
+        slots_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+uint32_t StateFile::hash(const void *data, size_t len, uint32_t seed)
+{
+    //  FNV-1a
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint32_t ret = seed;
+    for (size_t ii = 0; ii < len; ii++)
+    {
+        ret = (ret ^ bytes[ii]) * 16777619u;
+    }
+    return ret;
+}
+
+uint32_t StateFile::slotChecksum(const Slot &slot)
+{
+    uint32_t ret = hash(&slot.generation, sizeof(slot.generation));
+    ret = hash(&slot.length, sizeof(slot.length), ret);
+    return hash(&slot.snap, slot.length, ret);
+}
+
+const StateFile::Snapshot *StateFile::load() const
+{
+    if (!header_)
+    {
+        return nullptr;
+    }
+    const Slot *best = nullptr;
+    for (int ii = 0; ii < 2; ii++)
+    {
+        const Slot &slot = slots_[ii];
+        if (slot.generation != 0 && slot.length >= offsetof(Snapshot, message) && slot.length <= sizeof(Snapshot) &&
+            slot.snap.messages <= kMessages && slot.length == slot.snap.length() && slot.checksum == slotChecksum(slot) &&
+            (best == nullptr || slot.generation > best->generation))
+        {
+            best = &slot;
+        }
+    }
+    return best ? &best->snap : nullptr;
+}
+
+bool StateFile::sameBoot(const Snapshot &snap) const
+{
+    return boot_id_[0] != 0 && strncmp(boot_id_, snap.boot_id, sizeof(snap.boot_id)) == 0;
+}
+
+StateFile::Snapshot *StateFile::begin()
+{
+    if (!header_)
+    {
+        return nullptr;
+    }
+    Snapshot *snap = &slots_[spare_].snap;
+    memcpy(snap->boot_id, boot_id_, sizeof(snap->boot_id));
+    return snap;
+}
+
+void StateFile::commit()
+{
+    if (!header_)
+    {
+        return;
+    }
+    //  Checksum last: a crash before it leaves this slot failing the check
+    Slot &slot = slots_[spare_];
+    slot.generation = ++generation_;
+    slot.length = static_cast<uint32_t>(slot.snap.length());
+    slot.checksum = slotChecksum(slot);
+    spare_ ^= 1;
+}
@@ -0,0 +1,104 @@
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "msgqueue.h"
+
+//  Warm restart state file
+//
+//  What a restart needs to come back as it was (volume, mute, each adapter's
+//  TV power, active source and topology, the state sequence and the messages
+//  still waiting for a remote) is kept in a small memory-mapped file. There are
+//  two slots written in turn, each with a generation and a checksum, so a
+//  write cut short by a crash leaves the previous snapshot intact. Saving is a
+//  copy into the page cache with no fsync; it survives the process, not a power
+//  cut. Queue times are CLOCK_MONOTONIC, so messages are only restored within
+//  the same boot.
+class StateFile
+{
+public:
+    static const int    kMessages = MsgQueue::kCapacity;    // Queued messages kept
+    static const uint8_t kUnknown = 0xff;                   // Adapter field not known
+
+    struct Adapter
+    {
+        char            port[48];               // Adapter port, empty if detected
+        uint16_t        physical[16];           // Topology, logical -> physical (0xffff unknown)
+        uint8_t         power;                  // TV cec_power_status or kUnknown
+        uint8_t         active;                 // Active source logical address or kUnknown
+        char            osdname[16];            // Active source OSD name
+    };
+
+    struct Message
+    {
+        int64_t         queued;                 // Monotonic nsec when queued
+        int64_t         deadline;               // Monotonic nsec to expire, 0 never
+        uint32_t        remote;                 // hash() of the remote host
+        uint8_t         priority;               // MsgQueue::Priority
+        uint8_t         key;                    // MsgQueue::Key
+        uint16_t        len;                    // JSON text length
+        char            data[MsgBuffer::kSize];
+    };
+
+    struct Snapshot
+    {
+        char            boot_id[40];            // Boot the queue times belong to
+        uint32_t        epoch;                  // StateStore epoch and sequence
+        uint64_t        seq;
+        int32_t         volume;                 // Amplifier volume, -1 unknown
+        uint8_t         muted;                  // Amplifier muted
+        uint8_t         adapters;               // Adapters in use
+        uint16_t        messages;               // Messages in use
+        Adapter         adapter[MsgQueue::kAdapters];
+        Message         message[kMessages];
+
+        //  Bytes in use, the unused message slots are left out of the checksum
+        size_t length() const {return offsetof(Snapshot, message) + messages * sizeof(Message);}
+    };
+
+private:
+    struct Slot
+    {
+        uint64_t        generation;             // Saves so far when written, 0 empty
+        uint32_t        checksum;               // Over generation, length and the snapshot
+        uint32_t        length;                 // Snapshot bytes covered
+        Snapshot        snap;
+    };
+
+    struct Header
+    {
+        char            magic[8];               // "TVCECST1"
+        uint32_t        version;                // File version
+        uint32_t        slot_size;              // sizeof(Slot)
+    };
+
+    Header              *header_;               // Mapped header or null
+    Slot                *slots_;                // Mapped slots
+    size_t              map_size_;              // Mapped length
+    uint64_t            generation_;            // Newest generation in the file
+    int                 spare_;                 // Slot the next save goes to
+    char                boot_id_[40];           // This boot
+
+    static uint32_t slotChecksum(const Slot &slot);
+
+public:
+    StateFile();
+    ~StateFile();
+
+    bool open(const char *filename);
+    void close();
+    bool isOpen() const {return header_ != nullptr;}
+
+    //  Newest intact snapshot or null; valid until the next commit()
+    const Snapshot *load() const;
+    bool sameBoot(const Snapshot &snap) const;
+
+    //  Fill in the snapshot returned by begin(), then commit() it
+    Snapshot *begin();
+    void commit();
+
+    static uint32_t hash(const void *data, size_t len, uint32_t seed = 2166136261u);
+};
+
+#endif // STATEFILE_H
@@ -0,0 +1,133 @@
+#include "statestore.h"
+#include <QRandomGenerator>
+
+StateStore::StateStore() : seq_(0), resumed_(0)
+{
+    epoch_ = QRandomGenerator::global()->generate() & 0x7fffffff;
+    for (int ii = 0; ii < MsgQueue::kAdapters; ii++)
+    {
+        for (int jj = 0; jj < kAdapterFields; jj++)
+        {
+            adapters_[ii][jj].seq = 0;
+        }
+    }
+    volume_.seq = 0;
+    muted_.seq = 0;
+}
+
+bool StateStore::set(Value &field, const QJsonValue &value)
+{
+    if (field.value == value)
+    {
+        return false;
+    }
+    field.value = value;
+    field.seq = ++seq_;
+    return true;
+}
+
+bool StateStore::setPower(int adapter, int power)
+{
+    if (adapter < 0 || adapter >= MsgQueue::kAdapters)
+    {
+        return false;
+    }
+    return set(adapters_[adapter][Power], power);
+}
+
+bool StateStore::setActive(int adapter, int address, const std::string &osdname)
+{
+    if (adapter < 0 || adapter >= MsgQueue::kAdapters)
+    {
+        return false;
+    }
+    bool changed = set(adapters_[adapter][Active], address);
+    return set(adapters_[adapter][OsdName], QString::fromStdString(osdname)) || changed;
+}
+
+bool StateStore::setVolume(int volume)
+{
+    return set(volume_, volume);
+}
+
+bool StateStore::setMuted(bool muted)
+{
+    return set(muted_, muted);
+}
+
+int StateStore::power(int adapter) const
+{
+    return adapter >= 0 && adapter < MsgQueue::kAdapters ? adapters_[adapter][Power].value.toInt(-1) : -1;
+}
+
+int StateStore::active(int adapter) const
+{
+    return adapter >= 0 && adapter < MsgQueue::kAdapters ? adapters_[adapter][Active].value.toInt(-1) : -1;
+}
+
+std::string StateStore::osdName(int adapter) const
+{
+    return adapter >= 0 && adapter < MsgQueue::kAdapters ? adapters_[adapter][OsdName].value.toString().toStdString()
+                                                         : std::string();
+}
+
+void StateStore::restore(uint32_t epoch, uint64_t seq)
+{
+    if (seq == 0)
+    {
+        return;
+    }
+    epoch_ = epoch;
+    resumed_ = seq;
+    seq_ = seq + kRestartGap;
+    for (int ii = 0; ii < MsgQueue::kAdapters; ii++)
+    {
+        for (int jj = 0; jj < kAdapterFields; jj++)
+        {
+            if (adapters_[ii][jj].seq != 0)
+            {
+                adapters_[ii][jj].seq = seq;
+            }
+        }
+    }
+    if (volume_.seq != 0)
+    {
+        volume_.seq = seq;
+    }
+    if (muted_.seq != 0)
+    {
+        muted_.seq = seq;
+    }
+}
+
+void StateStore::add(QJsonObject &obj, const char *name, const Value &field, uint64_t since)
+{
+    if (field.seq > since && !field.value.isUndefined())
+    {
+        obj.insert(name, field.value);
+    }
+}
+
+QJsonObject StateStore::delta(int adapter, uint32_t epoch, uint64_t since, bool *full) const
+{
+    //  A sequence from another run, past the current one, or issued by the resumed
+    //  run after its last save cannot be trusted
+    if (epoch != epoch_ || since > seq_ || (resumed_ != 0 && since > resumed_ && since <= resumed_ + kRestartGap))
+    {
+        since = 0;
+    }
+    QJsonObject obj;
+    if (adapter >= 0 && adapter < MsgQueue::kAdapters)
+    {
+        add(obj, "power", adapters_[adapter][Power], since);
+        add(obj, "active", adapters_[adapter][Active], since);
+        add(obj, "osdname", adapters_[adapter][OsdName], since);
+    }
+    add(obj, "volume", volume_, since);
+    add(obj, "muted", muted_, since);
+    if (full)
+    {
+        *full = since == 0;
+    }
+    return obj;
+}
@@ -0,0 +1,76 @@
+#ifndef STATESTORE_H
+#define STATESTORE_H
+
+#include <stdint.h>
+#include <string>
+#include <QJsonObject>
+#include <QJsonValue>
+#include "msgqueue.h"
+
+//  Versioned copy of the state a remote shows
+//
+//  Every change bumps one sequence number and stamps the changed field with
+//  it, so a remote that last saw sequence N can be sent just the fields
+//  stamped after N. The epoch is new on a cold start and kept on a warm
+//  restart from the state file, where numbering resumes past anything the
+//  earlier run may have issued after its last save. A remote holding a
+//  sequence from another epoch, from the future, or from that unsaved range
+//  gets a full snapshot.
+//  Power, active source and its name are per adapter; volume and mute belong
+//  to the one amplifier.
+class StateStore
+{
+public:
+    enum Field
+    {
+        Power,
+        Active,
+        OsdName,
+        kAdapterFields
+    };
+
+private:
+    struct Value
+    {
+        QJsonValue      value;                  // Current value, undefined until first set
+        uint64_t        seq;                    // Sequence of the last change
+    };
+
+    uint32_t            epoch_;                 // Identifies this run
+    uint64_t            seq_;                   // Last sequence number issued
+    uint64_t            resumed_;               // Last saved sequence of the run this one continues, 0 none
+    Value               adapters_[MsgQueue::kAdapters][kAdapterFields];
+    Value               volume_;
+    Value               muted_;
+
+    bool set(Value &field, const QJsonValue &value);
+    static void add(QJsonObject &obj, const char *name, const Value &field, uint64_t since);
+
+public:
+    static const uint64_t kRestartGap = 1 << 20;    // Sequences skipped on a warm restart
+
+    StateStore();
+
+    uint32_t epoch() const {return epoch_;}
+    uint64_t seq() const {return seq_;}
+
+    bool setPower(int adapter, int power);
+    bool setActive(int adapter, int address, const std::string &osdname);
+    bool setVolume(int volume);
+    bool setMuted(bool muted);
+
+    int power(int adapter) const;
+    int active(int adapter) const;
+    std::string osdName(int adapter) const;
+    int volume() const {return volume_.value.toInt(-1);}
+    bool muted() const {return muted_.value.toBool();}
+
+    //  Continue the epoch of an earlier run whose values have been set again; they
+    //  are stamped with its last saved sequence and numbering resumes kRestartGap on
+    void restore(uint32_t epoch, uint64_t seq);
+
+    //  Fields changed after since in the given epoch, or everything; sets full accordingly
+    QJsonObject delta(int adapter, uint32_t epoch, uint64_t since, bool *full = nullptr) const;
+};
+
+#endif // STATESTORE_H
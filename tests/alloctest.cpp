@@ -0,0 +1,96 @@
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include "monotonic.h"
+#include "msgencoder.h"
+#include "msgqueue.h"
+
+//  Steady-state encoder and queue allocation check
+//
+//  Encoding a button click (JSON and CBOR) and passing it through the outbound
+//  queue must not touch the heap once warmed up. operator new is counted and
+//  any allocation in the measured loop fails the test. Only these two stages
+//  are covered: the rest of the send path (TVCEC and RemoteLink::flush, which
+//  builds a QString for text frames) is not.
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+static MsgQueue     queue;
+static MsgBuffer    json;
+static MsgBuffer    cbor;
+
+static bool encodeAndQueue(int ii)
+{
+    static const char *const labels[] = {"Vol+", "Vol-", "Mute"};
+    const char *label = labels[ii % 3];
+    if (!MsgEncoder::buttonClick(json, label) || !MsgEncoder::buttonClick(cbor, label, MsgBuffer::Cbor))
+    {
+        return false;
+    }
+    int64_t now = monotonicNs();
+    if (!queue.push(MsgQueue::Control, MsgQueue::NoKey, json, now) ||
+        !queue.push(MsgQueue::Control, MsgQueue::NoKey, cbor, now))
+    {
+        return false;
+    }
+    queue.pop_front();
+    queue.pop_front();
+    return true;
+}
+
+int main()
+{
+    const int kWarmup = 100;
+    const int kIterations = 100000;
+
+    for (int ii = 0; ii < kWarmup; ii++)
+    {
+        if (!encodeAndQueue(ii))
+        {
+            fprintf(stderr, "encode and queue failed during warm up\n");
+            return 1;
+        }
+    }
+
+    uint64_t before = allocations.load(std::memory_order_relaxed);
+    for (int ii = 0; ii < kIterations; ii++)
+    {
+        if (!encodeAndQueue(ii))
+        {
+            fprintf(stderr, "encode and queue failed at iteration %d\n", ii);
+            return 1;
+        }
+    }
+    uint64_t allocs = allocations.load(std::memory_order_relaxed) - before;
+
+    if (allocs != 0 || !queue.isEmpty())
+    {
+        fprintf(stderr, "%llu heap allocations in %d encode and queue iterations, %d entries left queued\n",
+                static_cast<unsigned long long>(allocs), kIterations, queue.size());
+        return 1;
+    }
+    printf("%d encode and queue iterations, no heap allocations\n", kIterations);
+    return 0;
+}
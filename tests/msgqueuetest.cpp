@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include "msgencoder.h"
+#include "msgqueue.h"
+
+//  Outbound queue checks
+//
+//  Entries come from a fixed pool, so every field of a queued message must be
+//  copied in rather than left over from the slot's last use, and a changed
+//  class lifetime applies to entries already queued.
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static void testFormat()
+{
+    MsgQueue queue;
+    MsgBuffer json, cbor;
+    MsgEncoder::buttonClick(json, "Vol+");
+    MsgEncoder::buttonClick(cbor, "Vol+", MsgBuffer::Cbor);
+
+    //  Run every slot through JSON first so a stale format would show
+    for (int ii = 0; ii < MsgQueue::kCapacity; ii++)
+    {
+        queue.push(MsgQueue::Control, MsgQueue::NoKey, json, 0);
+    }
+    queue.clear();
+
+    queue.push(MsgQueue::Control, MsgQueue::NoKey, cbor, 0);
+    const MsgQueue::Entry *ent = queue.front();
+    check(ent && ent->msg.format == MsgBuffer::Cbor, "CBOR entry keeps its format");
+    check(ent && ent->msg.len == cbor.len && memcmp(ent->msg.data, cbor.data, cbor.len) == 0, "CBOR entry keeps its bytes");
+    queue.pop_front();
+
+    queue.push(MsgQueue::Control, MsgQueue::NoKey, json, 0);
+    ent = queue.front();
+    check(ent && ent->msg.format == MsgBuffer::Json, "JSON entry in a reused CBOR slot is JSON");
+    queue.pop_front();
+    check(queue.isEmpty(), "queue empty after pops");
+}
+
+static void testDeadlineChange()
+{
+    const int64_t kMs = 1000000;
+    MsgQueue queue;
+    MsgBuffer json;
+    MsgEncoder::buttonClick(json, "Vol+");
+
+    //  An entry queued while the class never expired must not block the ones behind it
+    queue.setDeadline(MsgQueue::Control, 0);
+    queue.push(MsgQueue::Control, MsgQueue::NoKey, json, 1000 * kMs);
+    queue.setDeadline(MsgQueue::Control, 5000);
+    queue.push(MsgQueue::Control, MsgQueue::NoKey, json, 2000 * kMs);
+    check(queue.nextExpired(6100 * kMs) != nullptr, "deadline applies to entries queued before it was set");
+
+    //  A shorter lifetime applies to what is already queued
+    queue.setDeadline(MsgQueue::Control, 100);
+    const MsgQueue::Entry *ent = queue.nextExpired(1200 * kMs);
+    check(ent && ent->queued == 1000 * kMs, "oldest entry expires first after a shorter lifetime");
+    if (ent)
+    {
+        queue.removeExpired(ent);
+    }
+    check(queue.nextExpired(2200 * kMs) != nullptr, "newer entry expires under the shorter lifetime");
+}
+
+int main()
+{
+    testFormat();
+    testDeadlineChange();
+    if (failures)
+    {
+        return 1;
+    }
+    printf("msgqueue ok\n");
+    return 0;
+}
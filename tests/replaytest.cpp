@@ -0,0 +1,184 @@
+#include <QCoreApplication>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "captureserver.h"
+#include "cecreplay.h"
+#include "tvcec.h"
+#include "tvcecconfig.h"
+
+//  Replay regression test
+//
+//      replaytest <trace> <expected> [tolerance msec]
+//
+//  Replays a flight recorder trace through CECReplayAdapter at its recorded
+//  speed, with CaptureServer as the only remote, and compares what tvcec sent
+//  with the expected file. Each expected line is "<msec> <message>", msec
+//  being the time in the trace the message is due; "-" skips the timing check
+//  for messages whose time depends on the connection (the state sent when the
+//  remote connects). Messages must match in order and text, and the timed ones
+//  must keep their spacing within the tolerance.
+
+struct Line
+{
+    double          msec;                       // Time, NAN when not checked
+    std::string     text;                       // Message
+};
+
+static bool readLines(FILE *fp, bool expected, std::vector<Line> &lines)
+{
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), fp))
+    {
+        buf[strcspn(buf, "\r\n")] = 0;
+        if (buf[0] == 0 || buf[0] == '#')
+        {
+            continue;
+        }
+        Line line;
+        int pos = 0;
+        if (expected && buf[0] == '-')
+        {
+            line.msec = NAN;
+            pos = 1;
+        }
+        else if (sscanf(buf, "%lf%n", &line.msec, &pos) != 1)
+        {
+            fprintf(stderr, "bad line: %s\n", buf);
+            return false;
+        }
+        while (buf[pos] == ' ')
+        {
+            pos++;
+        }
+        line.text = buf + pos;
+        lines.push_back(line);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: replaytest <trace> <expected> [tolerance msec]\n");
+        return 2;
+    }
+    const char *tracefile = argv[1];
+    const char *expectedfile = argv[2];
+    double tolerance = argc > 3 ? atof(argv[3]) : 100.0;
+
+    QCoreApplication a(argc, argv);
+
+    std::vector<Line> expected;
+    FILE *fp = fopen(expectedfile, "r");
+    if (!fp || !readLines(fp, true, expected))
+    {
+        fprintf(stderr, "Cannot read %s\n", expectedfile);
+        return 1;
+    }
+    fclose(fp);
+
+    CECReplayAdapter *replay = new CECReplayAdapter(1.0);
+    if (!replay->load(tracefile))
+    {
+        delete replay;
+        return 1;
+    }
+    FILE *captureout = tmpfile();
+    CaptureServer *capture = new CaptureServer(captureout, false);
+    if (!captureout || !capture->listen())
+    {
+        fprintf(stderr, "Cannot start the capture server\n");
+        delete capture;
+        delete replay;
+        return 1;
+    }
+
+    //  Give the last messages time to arrive; a replay that never ends fails
+    replay->setFinished([]()
+    {
+        QMetaObject::invokeMethod(qApp, []() {QTimer::singleShot(1000, qApp, &QCoreApplication::quit);},
+                                  Qt::QueuedConnection);
+    });
+    bool timedOut = false;
+    QTimer::singleShot(30000, qApp, [&timedOut]() {timedOut = true; qApp->quit();});
+
+    TVCEC *tvcec = new TVCEC();
+    tvcec->setAdapter(replay);
+    TVCECConfig config;
+    config.logMask = 0;
+    config.remotes << QString("127.0.0.1:%1").arg(capture->port());
+    tvcec->setCborAllowed(false);
+    tvcec->applyConfig(config);
+    if (!tvcec->init())
+    {
+        fprintf(stderr, "tvcec did not start on the replay adapter\n");
+        delete tvcec;
+        delete capture;
+        return 1;
+    }
+    a.exec();
+    delete tvcec;
+    delete capture;
+
+    std::vector<Line> captured;
+    rewind(captureout);
+    bool ok = readLines(captureout, false, captured);
+    fclose(captureout);
+    if (timedOut)
+    {
+        fprintf(stderr, "replay did not finish\n");
+        ok = false;
+    }
+
+    //  Timing is relative: the first timed message sets the offset
+    double offset = NAN;
+    size_t count = std::max(expected.size(), captured.size());
+    for (size_t ii = 0; ii < count; ii++)
+    {
+        if (ii >= captured.size())
+        {
+            fprintf(stderr, "missing message %zu: %s\n", ii, expected[ii].text.c_str());
+            ok = false;
+            continue;
+        }
+        if (ii >= expected.size())
+        {
+            fprintf(stderr, "unexpected message %zu: %s\n", ii, captured[ii].text.c_str());
+            ok = false;
+            continue;
+        }
+        const Line &exp = expected[ii];
+        const Line &cap = captured[ii];
+        if (exp.text != cap.text)
+        {
+            fprintf(stderr, "message %zu differs\n  expected %s\n  captured %s\n", ii, exp.text.c_str(), cap.text.c_str());
+            ok = false;
+            continue;
+        }
+        if (std::isnan(exp.msec))
+        {
+            continue;
+        }
+        if (std::isnan(offset))
+        {
+            offset = cap.msec - exp.msec;
+        }
+        double late = cap.msec - offset - exp.msec;
+        if (std::fabs(late) > tolerance)
+        {
+            fprintf(stderr, "message %zu at %.1f msec, expected %.1f (+/- %.0f): %s\n", ii, cap.msec - offset, exp.msec,
+                    tolerance, exp.text.c_str());
+            ok = false;
+        }
+    }
+
+    printf("%zu messages captured, %zu expected: %s\n", captured.size(), expected.size(), ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
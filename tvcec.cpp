@@ -1,132 +1,451 @@
 #include "tvcec.h"
 #include <QtDebug>
+#include <QCborValue>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
 #include <iostream>
+#include <string.h>
+#include "monotonic.h"
+#include "sdnotify.h"
 
-TVCEC::TVCEC(QObject *parent) : QObject{parent}, volume_(60), volCountAdj_(0), push_to_front_(false), health_(0)
+TVCEC::TVCEC(QObject *parent) : QObject{parent}, metricsServer_(nullptr), origin_(0), created_(monotonicNs()), cborAllowed_(true),
+    pingIdle_(30000), pingActive_(2000), started_(false), volume_(60), volCountAdj_(0), muted_(false), predictive_(false),
+    defer_send_(false)
 {
     log_ = new CECLog();
+    trace_ = new CECTrace();
+    metrics_ = new Metrics();
 
-    remote_ = "tvremote.local";
-    websocket_ = new QWebSocket("tvcec");
-    connect(websocket_, &QWebSocket::connected, this, &TVCEC::ws_connected);
-    connect(websocket_, &QWebSocket::disconnected, this, &TVCEC::ws_disconnected);
-    connect(websocket_, &QWebSocket::textFrameReceived, this, &TVCEC::textMessage);
-    connect(websocket_, &QWebSocket::pong, this, &TVCEC::ws_pong);
-
-    cec_ = new CECAudio(log_);
-    connect(cec_, &CECAudio::tv_powerChanged, this, &TVCEC::tv_powerChanged, Qt::QueuedConnection);
-    connect(cec_, &CECAudio::active_deviceChanged, this, &TVCEC::active_deviceChanged, Qt::QueuedConnection);
-    connect(cec_, &CECAudio::volumeUp, this, &TVCEC::volumeUp, Qt::QueuedConnection);
-    connect(cec_, &CECAudio::volumeDown, this, &TVCEC::volumeDown, Qt::QueuedConnection);
-    connect(cec_, &CECAudio::toggleMute, this, &TVCEC::toggleMute, Qt::QueuedConnection);
-    connect(this, &TVCEC::volumeChanged, cec_, &CECAudio::setVolume);
-    connect(this, &TVCEC::mutingChanged, cec_, &CECAudio::setMuted);
-
-    timer_ = new QTimer(this);
-    timer_->setInterval(30000);
-    connect(timer_, &QTimer::timeout, this, &TVCEC::healthCheck);
+    MsgQueue defaults;
+    for (int ii = 0; ii < MsgQueue::kPriorities; ii++)
+    {
+        deadlines_[ii] = defaults.deadline(static_cast<MsgQueue::Priority>(ii));
+    }
+
+    cec_ = addAdapter();
+    state_.setVolume(volume_);
+    state_.setMuted(muted_);
+
+    sequence_ = new CECSequence(cec_, log_, this);
+    connect(sequence_, &CECSequence::finished, this, &TVCEC::sequenceFinished);
+    keyRepeat_ = new CECKeyRepeat(cec_, log_, metrics_, this);
+    connect(keyRepeat_, &CECKeyRepeat::forcedRelease, this, &TVCEC::keyForcedRelease);
 
     volTimer_ = new QTimer(this);
     volTimer_->setInterval(3000);
     volTimer_->setSingleShot(true);
+
+    //  Saved once the current event is handled, however many changes it made
+    saveTimer_ = new QTimer(this);
+    saveTimer_->setInterval(0);
+    saveTimer_->setSingleShot(true);
+    connect(saveTimer_, &QTimer::timeout, this, &TVCEC::saveState);
+
+    coalescer_ = new VolumeCoalescer(this);
+    //  Burst ends come later from the coalescer's timer; tag them with the burst's adapter
+    connect(coalescer_, &VolumeCoalescer::holdStart, this, [this](const char *label)
+    {
+        sendButtonPress(cecs_.value(coalescer_->source(), cec_), label);
+    });
+    connect(coalescer_, &VolumeCoalescer::holdStop, this, [this](const char *label)
+    {
+        sendButtonRelease(cecs_.value(coalescer_->source(), cec_), label);
+    });
+    connect(coalescer_, &VolumeCoalescer::step, this, [this](const char *label, int count)
+    {
+        sendButtonStep(cecs_.value(coalescer_->source(), cec_), label, count);
+    });
 }
 
 TVCEC::~TVCEC()
 {
-    delete cec_;
-    delete websocket_;
+    if (stateFile_.isOpen())
+    {
+        saveState();
+    }
+    delete sequence_;
+    delete keyRepeat_;
+    qDeleteAll(cecs_);
+    qDeleteAll(links_);
+    delete metricsServer_;
+    delete metrics_;
+    delete trace_;
     delete log_;
 }
 
+CECAudio *TVCEC::addAdapter()
+{
+    //  Each adapter has its own libcec instance, worker thread and audio state; they
+    //  all drive the one amplifier, so volume changes go to every adapter
+    CECAudio *cec = new CECAudio(log_, trace_, metrics_);
+    connect(cec, &CECAudio::tv_powerChanged, this, &TVCEC::tv_powerChanged, Qt::QueuedConnection);
+    connect(cec, &CECAudio::active_deviceChanged, this, &TVCEC::active_deviceChanged, Qt::QueuedConnection);
+    connect(cec, &CECAudio::volumeUp, this, &TVCEC::volumeUp, Qt::QueuedConnection);
+    connect(cec, &CECAudio::volumeDown, this, &TVCEC::volumeDown, Qt::QueuedConnection);
+    connect(cec, &CECAudio::toggleMute, this, &TVCEC::toggleMute, Qt::QueuedConnection);
+    connect(cec, &CECAudio::audioStatusChanged, this, &TVCEC::audioStatusChanged, Qt::QueuedConnection);
+    connect(this, &TVCEC::volumeChanged, cec, &CECAudio::setVolume);
+    connect(this, &TVCEC::mutingChanged, cec, &CECAudio::setMuted);
+    cecs_.append(cec);
+    return cec;
+}
+
+void TVCEC::setAdapterPorts(const QStringList &ports)
+{
+    //  Before init(); the first port goes to the primary adapter
+    while (cecs_.size() > 1)
+    {
+        delete cecs_.takeLast();
+    }
+    for (int ii = 0; ii < ports.size() && ii < MsgQueue::kAdapters; ii++)
+    {
+        CECAudio *cec = ii == 0 ? cec_ : addAdapter();
+        cec->setPort(ports.at(ii).toStdString());
+        cec->setLog_level(cec_->log_level());
+    }
+    if (ports.size() > MsgQueue::kAdapters)
+    {
+        CECLOG(log_, General, Warn, "Only the first %d CEC adapters are used", MsgQueue::kAdapters);
+    }
+}
+
+void TVCEC::setLogLevel(CEC::cec_log_level level)
+{
+    for (CECAudio *cec : cecs_)
+    {
+        cec->setLog_level(level);
+    }
+    log_->setTrace((level & (CEC::CEC_LOG_NOTICE | CEC::CEC_LOG_DEBUG)) != 0);
+}
+
+void TVCEC::setVolumePrediction(int step)
+{
+    predictive_ = step > 0;
+    for (CECAudio *cec : cecs_)
+    {
+        cec->setVolumePrediction(step);
+    }
+}
+
+CECAudio *TVCEC::eventSource() const
+{
+    //  A slot run from a CECAudio signal concerns that adapter; called directly, the primary
+    CECAudio *cec = qobject_cast<CECAudio *>(sender());
+    return cec ? cec : cec_;
+}
+
+int TVCEC::adapterTag(CECAudio *cec) const
+{
+    return cecs_.size() > 1 ? cecs_.indexOf(cec) : -1;
+}
+
 bool TVCEC::init()
 {
-    return cec_->init();
+    int64_t start = monotonicNs();
+    for (CECAudio *cec : cecs_)
+    {
+        if (!cec->init())
+        {
+            return false;
+        }
+    }
+    int64_t opened = monotonicNs();
+    started_ = true;
+    for (RemoteLink *link : links_)
+    {
+        link->connectToRemote();
+    }
+
+    //  Volume keys work from here on; bus discovery and remote connections finish in the background
+    sdNotify("READY=1\nSTATUS=CEC adapter open");
+    CECLOG(log_, General, Info, "Startup: setup %d msec, CEC adapter %d msec, remotes %d msec",
+           static_cast<int>((start - created_) / 1000000), static_cast<int>((opened - start) / 1000000),
+           static_cast<int>((monotonicNs() - opened) / 1000000));
+    return true;
+}
+
+void TVCEC::setRemotes(const QStringList &remotes)
+{
+    //  A remote still listed keeps its link, connection and queue; once running,
+    //  links to new remotes connect at once
+    QList<RemoteLink *> links;
+    QStringList old = remotes_;
+    for (const QString &remote : remotes)
+    {
+        int idx = old.indexOf(remote);
+        if (idx >= 0)
+        {
+            links.append(links_.at(idx));
+            old[idx].clear();
+            continue;
+        }
+        RemoteLink *link = new RemoteLink(log_, metrics_, this);
+        link->setHost(remote);
+        link->setCborAllowed(cborAllowed_);
+        link->setPingIntervals(pingIdle_, pingActive_);
+        for (int ii = 0; ii < MsgQueue::kPriorities; ii++)
+        {
+            link->setQueueDeadline(static_cast<MsgQueue::Priority>(ii), deadlines_[ii]);
+        }
+        connect(link, &RemoteLink::connected, this, &TVCEC::ws_connected);
+        connect(link, &RemoteLink::disconnected, this, &TVCEC::ws_disconnected);
+        connect(link, &RemoteLink::messageReceived, this, &TVCEC::remoteMessage);
+        connect(link, &RemoteLink::pong, this, &TVCEC::ws_pong);
+        links.append(link);
+        if (started_)
+        {
+            CECLOG(log_, Ws, Info, "Remote %s added", qPrintable(remote));
+            link->connectToRemote();
+        }
+    }
+    for (RemoteLink *link : links_)
+    {
+        if (!links.contains(link))
+        {
+            if (link == keyLink_)
+            {
+                keyRepeat_->release();
+            }
+            if (started_)
+            {
+                CECLOG(log_, Ws, Info, "Remote %s removed", qPrintable(link->host()));
+            }
+            delete link;
+        }
+    }
+    links_ = links;
+    remotes_ = remotes;
+}
+
+void TVCEC::setCborAllowed(bool allowed)
+{
+    //  Takes effect on the next connect
+    cborAllowed_ = allowed;
+    for (RemoteLink *link : links_)
+    {
+        link->setCborAllowed(allowed);
+    }
+}
+
+void TVCEC::setQueueDeadline(MsgQueue::Priority priority, int msec)
+{
+    deadlines_[priority] = msec;
+    for (RemoteLink *link : links_)
+    {
+        link->setQueueDeadline(priority, msec);
+    }
+}
+
+void TVCEC::setPingIntervals(int idleMsec, int activeMsec)
+{
+    pingIdle_ = idleMsec;
+    pingActive_ = activeMsec;
+    for (RemoteLink *link : links_)
+    {
+        link->setPingIntervals(idleMsec, activeMsec);
+    }
+}
+
+void TVCEC::applyConfig(const TVCECConfig &config)
+{
+    //  Applied in one go on the Qt thread, so no event or message is handled
+    //  under a mix of old and new settings. The CEC adapters stay open; a
+    //  change of adapters waits for a restart.
+    setLogLevel(static_cast<CEC::cec_log_level>(config.logLevel));
+    setLogMask(static_cast<uint16_t>(config.logMask));
+    for (const QString &level : config.logLevels)
+    {
+        QByteArray category = level.section(':', 0, 0).toLatin1();
+        QByteArray name = level.section(':', 1).toLatin1();
+        LogCategory cat;
+        LogLevel lvl;
+        if (CECLog::parseCategory(category.constData(), &cat) && CECLog::parseLevel(name.constData(), &lvl))
+        {
+            log_->setLevel(cat, lvl);
+        }
+    }
+    QByteArray logfile = config.logFile.toLocal8Bit();
+    setLogFile(logfile.isEmpty() ? nullptr : logfile.constData());
+    for (int ii = 0; ii < MsgQueue::kPriorities; ii++)
+    {
+        setQueueDeadline(static_cast<MsgQueue::Priority>(ii), config.deadlines[ii]);
+    }
+    volTimer_->setInterval(config.volumeTimer);
+    for (CECAudio *cec : cecs_)
+    {
+        cec->setAudioStatusDelay(config.audioStatusDelay);
+    }
+    setPingIntervals(config.pingIdle, config.pingActive);
+    setRemotes(config.remotes);
+    CECLOG(log_, General, Info, "Configuration: %d remotes, CEC log level %#x, log mask %#x", static_cast<int>(links_.size()),
+           config.logLevel, config.logMask);
+}
+
+bool TVCEC::setMetricsPort(quint16 port)
+{
+    delete metricsServer_;
+    metricsServer_ = nullptr;
+    if (port == 0)
+    {
+        return true;
+    }
+    metricsServer_ = new MetricsServer(metrics_);
+    if (!metricsServer_->listen(port))
+    {
+        CECLOG(log_, General, Error, "Cannot listen for metrics on port %d", port);
+        return false;
+    }
+    return true;
 }
 
 void TVCEC::tv_powerChanged(CEC::cec_power_status power)
 {
-    log_->print(1, "Slot tv_powerChanged %d", power);
+    CECAudio *cec = eventSource();
+    CECLOG(log_, CecRx, Debug, "Slot tv_powerChanged %d", power);
+    //  Measure CEC to websocket latency for messages caused by a frame
+    origin_ = cec->lastRxNs();
+    state_.setPower(cecs_.indexOf(cec), power);
+    sendPower(cec, nullptr, power);
+    origin_ = 0;
+}
+
+void TVCEC::active_deviceChanged(CEC::cec_logical_address logaddr, std::string name)
+{
+    CECAudio *cec = eventSource();
+    CECLOG(log_, CecRx, Debug, "Slot active_deviceChanged %d (%s)", logaddr, name.c_str());
+    origin_ = cec->lastRxNs();
+    state_.setActive(cecs_.indexOf(cec), logaddr, name);
+    sendActive(cec, nullptr, logaddr, name);
+    origin_ = 0;
+}
+
+void TVCEC::sendPower(CECAudio *cec, RemoteLink *link, CEC::cec_power_status power)
+{
     if (power == CEC::CEC_POWER_STATUS_ON)
     {
-        sendButtonClick(("TVOn"));
-        cec_->getActiveAddress();
+        sendButtonClick(cec, link, "TVOn", MsgQueue::State, MsgQueue::PowerKey);
     }
     else if (power == CEC::CEC_POWER_STATUS_STANDBY)
     {
-        sendButtonClick(("TVOff"));
+        sendButtonClick(cec, link, "TVOff", MsgQueue::State, MsgQueue::PowerKey);
     }
 }
 
-void TVCEC::active_deviceChanged(CEC::cec_logical_address logaddr, std::string name)
+void TVCEC::sendActive(CECAudio *cec, RemoteLink *link, CEC::cec_logical_address logaddr, const std::string &name)
 {
-    log_->print(1, "Slot active_deviceChanged %d (%s)", logaddr, name.c_str());
-    QJsonObject msg;
-    msg.insert("func", QJsonValue("input_select"));
-    msg.insert("path", QJsonValue("/tvadapter"));
-    msg.insert("address", QJsonValue(logaddr));
-    msg.insert("osdname", QJsonValue(name.c_str()));
-    sendToWebsocket(msg);
+    MsgBuffer msg, cbor;
+    MsgEncoder::inputSelect(msg, logaddr, name.c_str());
+    if (wantCbor(link))
+    {
+        MsgEncoder::inputSelect(cbor, logaddr, name.c_str(), MsgBuffer::Cbor);
+    }
+    sendToWebsocket(cec, link, msg, cbor, MsgQueue::State, MsgQueue::InputKey);
 }
 
 void TVCEC::volumeUp(bool pressed)
 {
-    if (cec_->log_level() & CEC::CEC_LOG_DEBUG)
-    {
-        log_->print(1, "Slot volumeUp %s", pressed ? "pressed" : "released");
-    }
+    CECAudio *cec = eventSource();
+    CECLOG(log_, Volume, Trace, "Slot volumeUp %s", pressed ? "pressed" : "released");
     setMuted(false);
     if (pressed)
     {
-        sendButtonPress("Vol+");
         if (!volTimer_->isActive())
         {
             volTimer_->start();
             volCountAdj_ = 1;
         }
     }
-    else
-    {
-        sendButtonRelease("Vol+");
-    }
+    origin_ = cec->lastRxNs();
+    coalescer_->keyEvent("Vol+", pressed, cecs_.indexOf(cec));
+    origin_ = 0;
 }
 
 void TVCEC::volumeDown(bool pressed)
 {
-    if (cec_->log_level() & CEC::CEC_LOG_DEBUG)
-    {
-        log_->print(1, "Slot volumeDown", pressed ? "pressed" : "released");
-    }
+    CECAudio *cec = eventSource();
+    CECLOG(log_, Volume, Trace, "Slot volumeDown %s", pressed ? "pressed" : "released");
     setMuted(false);
     if (pressed)
     {
-        sendButtonPress("Vol-");
         if (!volTimer_->isActive())
         {
             volTimer_->start();
             volCountAdj_ = 1;
         }
     }
-    else
+    origin_ = cec->lastRxNs();
+    coalescer_->keyEvent("Vol-", pressed, cecs_.indexOf(cec));
+    origin_ = 0;
+}
+
+void TVCEC::toggleMute()
+{
+    CECAudio *cec = eventSource();
+    CECLOG(log_, Volume, Trace, "Slot toggleMute");
+    if (!predictive_)
     {
-        sendButtonRelease("Vol-");
+        //  When predicting CECAudio has toggled already and reports it with audioStatusChanged
+        setMuted(!muted_);
     }
+    origin_ = cec->lastRxNs();
+    sendButtonClick(cec, nullptr, "Mute");
+    origin_ = 0;
 }
 
-void TVCEC::toggleMute()
+void TVCEC::audioStatusChanged(int volume, bool muted)
 {
-    if (cec_->log_level() & CEC::CEC_LOG_DEBUG)
+    //  Follow the predicted state without feeding it back to the adapter that
+    //  predicted it; the other adapters share the amplifier and take it as is
+    CECAudio *from = qobject_cast<CECAudio *>(sender());
+    volume_ = volume;
+    muted_ = muted;
+    state_.setVolume(volume_);
+    state_.setMuted(muted_);
+    scheduleSave();
+    for (CECAudio *cec : cecs_)
     {
-        log_->print(1, "Slot toggleMute");
+        if (cec != from)
+        {
+            cec->setVolume(volume);
+            cec->setMuted(muted);
+        }
+    }
+}
+
+void TVCEC::setRemoteVolume(const QJsonObject &obj)
+{
+    //  The remote reports the real amplifier state; it overrides any estimate or prediction
+    QJsonValue vol = obj.value("volume");
+    if (vol.isDouble())
+    {
+        int volume = vol.toInt();
+        volume_ = volume < 0 ? 0 : volume > 100 ? 100 : volume;
+        state_.setVolume(volume_);
+        scheduleSave();
+        emit volumeChanged(volume_);
+    }
+    QJsonValue mute = obj.value("muted");
+    if (mute.isBool())
+    {
+        setMuted(mute.toBool());
+    }
+    CECLOG(log_, Volume, Debug, "Remote volume %d%s", volume_, muted_ ? " muted" : "");
+    for (CECAudio *cec : cecs_)
+    {
+        cec->reportAudioStatus();
     }
-    setMuted(!muted_);
-    sendButtonClick("Mute");
 }
 
 void TVCEC::adjustVolume(const QString &func, int repeat)
 {
+    if (predictive_)
+    {
+        //  Key presses already moved the modelled volume
+        return;
+    }
+
     setMuted(false);
     if (volTimer_->isActive() && volCountAdj_ > 0)
     {
@@ -150,9 +469,11 @@ void TVCEC::adjustVolume(const QString &func, int repeat)
     }
     if (volume_ < 0) volume_ = 0;
     if (volume_ > 100) volume_ = 100;
+    state_.setVolume(volume_);
+    scheduleSave();
 
     emit volumeChanged(volume_);
-    log_->print(1, "Volume adjusted by %d (%d) to %d", adj, repeat, volume_);
+    CECLOG(log_, Volume, Debug, "Volume adjusted by %d (%d) to %d", adj, repeat, volume_);
 }
 
 void TVCEC::setMuted(bool muted)
@@ -160,121 +481,469 @@ void TVCEC::setMuted(bool muted)
     if (muted != muted_)
     {
         muted_ = muted;
+        state_.setMuted(muted_);
+        scheduleSave();
         emit mutingChanged(muted_);
     }
 }
 
-bool TVCEC::sendToWebsocket(const QJsonObject &msg)
+bool TVCEC::sendToWebsocket(CECAudio *cec, RemoteLink *link, const QJsonObject &msg, MsgQueue::Priority priority)
 {
-    QJsonDocument doc(msg);
-    QByteArray txtmsg = doc.toJson(QJsonDocument::Compact);
-    if (cec_->log_level() & CEC::CEC_LOG_DEBUG)
+    //  General messages off the key path
+    QByteArray txtmsg = QJsonDocument(msg).toJson(QJsonDocument::Compact);
+    MsgBuffer buf;
+    if (!MsgEncoder::copy(buf, txtmsg.constData(), txtmsg.size()))
     {
-        log_->print(1, "send: %s", txtmsg.constData());
+        CECLOG(log_, Ws, Warn, "Message too long (%d bytes) not sent", txtmsg.size());
+        return false;
     }
-    time_t now;
-    time(&now);
-    if (!push_to_front_)
+    MsgBuffer cbor;
+    if (wantCbor(link))
     {
-        msg_queue_.emplaceBack(now, QString(txtmsg));
-        return sendQueuedMessages();
+        QByteArray binmsg = QCborValue::fromJsonValue(msg).toCbor();
+        MsgEncoder::copy(cbor, binmsg.constData(), binmsg.size(), MsgBuffer::Cbor);
     }
-    msg_queue_.emplaceFront(now, QString(txtmsg));
-    return true;
+    return sendToWebsocket(cec, link, buf, cbor, priority);
 }
 
-bool TVCEC::sendButtonClick(const char *label)
+bool TVCEC::sendToWebsocket(CECAudio *cec, RemoteLink *link, const MsgBuffer &msg, MsgQueue::Priority priority,
+                            MsgQueue::Key key)
 {
-    QJsonObject msg;
-    msg.insert("func", QJsonValue("tv_btn_click"));
-    msg.insert("path", QJsonValue("/tvadapter"));
-    msg.insert("button", QJsonValue(label));
-    return sendToWebsocket(msg);
+    return sendToWebsocket(cec, link, msg, MsgBuffer(), priority, key);
 }
 
-bool TVCEC::sendButtonPress(const char *label)
+bool TVCEC::wantCbor(RemoteLink *target) const
 {
-    QJsonObject msg;
-    msg.insert("func", QJsonValue("tv_btn_press"));
-    msg.insert("path", QJsonValue("/tvadapter"));
-    msg.insert("button", QJsonValue(label));
-    return sendToWebsocket(msg);
+    for (RemoteLink *link : links_)
+    {
+        if (link->isCbor() && (target == nullptr || target == link))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-bool TVCEC::sendButtonRelease(const char *label)
+bool TVCEC::sendToWebsocket(CECAudio *cec, RemoteLink *link, const MsgBuffer &json, const MsgBuffer &cbor,
+                            MsgQueue::Priority priority, MsgQueue::Key key)
 {
-    QJsonObject msg;
-    msg.insert("func", QJsonValue("tv_btn_release"));
-    msg.insert("path", QJsonValue("/tvadapter"));
-    msg.insert("button", QJsonValue(label));
-    return sendToWebsocket(msg);
+    if (json.len == 0)
+    {
+        return false;
+    }
+    CECLOG(log_, Ws, Trace, "send: %s", json.data);
+    //  With several adapters every message says which one it concerns
+    int adapter = adapterTag(cec);
+    if (adapter >= 0)
+    {
+        MsgBuffer tagged = json;
+        MsgBuffer taggedCbor = cbor;
+        MsgEncoder::tagAdapter(tagged, adapter);
+        if (taggedCbor.len > 0)
+        {
+            MsgEncoder::tagAdapter(taggedCbor, adapter);
+        }
+        return enqueue(link, tagged, taggedCbor, priority, MsgQueue::adapterKey(key, adapter));
+    }
+    return enqueue(link, json, cbor, priority, key);
+}
+
+bool TVCEC::enqueue(RemoteLink *target, const MsgBuffer &json, const MsgBuffer &cbor, MsgQueue::Priority priority,
+                    MsgQueue::Key key)
+{
+    //  Every remote gets its own copy, or only the one being answered, in the
+    //  format it negotiated; JSON if there is no CBOR encoding
+    bool ret = true;
+    for (RemoteLink *link : links_)
+    {
+        if (target == nullptr || target == link)
+        {
+            link->enqueue(link->isCbor() && cbor.len > 0 ? cbor : json, priority, key, origin_);
+            if (!defer_send_)
+            {
+                ret = link->flush() && ret;
+            }
+        }
+    }
+    scheduleSave();
+    return ret;
+}
+
+bool TVCEC::sendButtonClick(CECAudio *cec, RemoteLink *link, const char *label, MsgQueue::Priority priority,
+                            MsgQueue::Key key)
+{
+    MsgBuffer msg, cbor;
+    MsgEncoder::buttonClick(msg, label);
+    if (wantCbor(link))
+    {
+        MsgEncoder::buttonClick(cbor, label, MsgBuffer::Cbor);
+    }
+    return sendToWebsocket(cec, link, msg, cbor, priority, key);
+}
+
+bool TVCEC::sendButtonPress(CECAudio *cec, const char *label)
+{
+    MsgBuffer msg, cbor;
+    MsgEncoder::buttonPress(msg, label);
+    if (wantCbor(nullptr))
+    {
+        MsgEncoder::buttonPress(cbor, label, MsgBuffer::Cbor);
+    }
+    return sendToWebsocket(cec, nullptr, msg, cbor, MsgQueue::Control);
 }
 
-void TVCEC::doCECCommand(const QJsonObject &obj)
+bool TVCEC::sendButtonRelease(CECAudio *cec, const char *label)
 {
+    MsgBuffer msg, cbor;
+    MsgEncoder::buttonRelease(msg, label);
+    if (wantCbor(nullptr))
+    {
+        MsgEncoder::buttonRelease(cbor, label, MsgBuffer::Cbor);
+    }
+    return sendToWebsocket(cec, nullptr, msg, cbor, MsgQueue::Control);
+}
+
+bool TVCEC::sendButtonStep(CECAudio *cec, const char *label, int count)
+{
+    MsgBuffer msg, cbor;
+    MsgEncoder::buttonStep(msg, label, count);
+    if (wantCbor(nullptr))
+    {
+        MsgEncoder::buttonStep(cbor, label, count, MsgBuffer::Cbor);
+    }
+    return sendToWebsocket(cec, nullptr, msg, cbor, MsgQueue::Control);
+}
+
+void TVCEC::doCECCommand(CECAudio *cec, RemoteLink *link, const QJsonObject &obj)
+{
+    //  cec is the adapter named by the message's "adapter" field; replies go to link
     QJsonValue cmd = obj.value("cmd");
     if (cmd == "root_menu")
     {
-        cec_->sendUserKeyPress(CEC::CEC_USER_CONTROL_CODE_ROOT_MENU);
+        cec->sendUserKeyPress(CEC::CEC_USER_CONTROL_CODE_ROOT_MENU);
     }
     else if (cmd == "key_click")
     {
         uint16_t val1 = obj.value("val1").toInt();
-        cec_->sendUserKeyPress(static_cast<CEC::cec_user_control_code>(val1));
+        cec->sendUserKeyPress(static_cast<CEC::cec_user_control_code>(val1));
+    }
+    else if (cmd == "key_press")
+    {
+        //  Held until key_release; the remote repeats key_press to keep the hold alive
+        uint16_t val1 = obj.value("val1").toInt();
+        sequence_->cancel();
+        keyLink_ = link;
+        keyRepeat_->setCEC(cec);
+        keyRepeat_->press(static_cast<CEC::cec_user_control_code>(val1));
+    }
+    else if (cmd == "key_release")
+    {
+        keyRepeat_->release();
+    }
+    else if (cmd == "sequence")
+    {
+        startSequence(cec, link, obj);
+    }
+    else if (cmd == "cancel")
+    {
+        sequence_->cancel();
+    }
+    else if (cmd == "topology")
+    {
+        QStringList devices = cec->topology().dump();
+        QJsonArray list;
+        for (const QString &dev : devices)
+        {
+            CECLOG(log_, General, Info, "Topology %s", qPrintable(dev));
+            list.append(dev);
+        }
+        QJsonObject msg;
+        msg.insert("func", QJsonValue("topology"));
+        msg.insert("path", QJsonValue("/tvadapter"));
+        msg.insert("devices", list);
+        sendToWebsocket(cec, link, msg);
+    }
+}
+
+void TVCEC::startSequence(CECAudio *cec, RemoteLink *link, const QJsonObject &obj)
+{
+    //  {"action":"cec","cmd":"sequence","id":"home-ok","steps":[{"key":9},{"key":0,"hold":50}]}
+    QString id = obj.value("id").toVariant().toString();
+    QVector<CECSequence::Step> steps;
+    QString error;
+    if (!CECSequence::parse(obj.value("steps").toArray(), steps, &error))
+    {
+        CECLOG(log_, CecTx, Warn, "Sequence %s rejected: %s", qPrintable(id), qPrintable(error));
+        sendSequenceStatus(cec, link, id, CECSequence::Failed, -1, 0, error);
+        return;
+    }
+    //  The running sequence reports its cancellation to its own remote
+    keyRepeat_->release();
+    sequence_->cancel();
+    sequenceLink_ = link;
+    sequence_->setCEC(cec);
+    sequence_->start(id, steps);
+}
+
+void TVCEC::keyForcedRelease(CEC::cec_user_control_code key)
+{
+    if (keyLink_)
+    {
+        QJsonObject msg;
+        msg.insert("func", QJsonValue("key_release"));
+        msg.insert("path", QJsonValue("/tvadapter"));
+        msg.insert("key", QJsonValue(static_cast<int>(key)));
+        msg.insert("reason", QJsonValue("watchdog"));
+        sendToWebsocket(keyRepeat_->cec(), keyLink_, msg, MsgQueue::Control);
+    }
+}
+
+void TVCEC::sequenceFinished(const QString &id, CECSequence::Status status, int step, int elapsedMs, const QString &error)
+{
+    //  The result goes to the remote that started the sequence, if it is still there
+    if (sequenceLink_)
+    {
+        sendSequenceStatus(sequence_->cec(), sequenceLink_, id, status, step, elapsedMs, error);
+    }
+}
+
+void TVCEC::sendSequenceStatus(CECAudio *cec, RemoteLink *link, const QString &id, CECSequence::Status status, int step,
+                               int elapsedMs, const QString &error)
+{
+    QJsonObject msg;
+    msg.insert("func", QJsonValue("sequence"));
+    msg.insert("path", QJsonValue("/tvadapter"));
+    msg.insert("id", QJsonValue(id));
+    msg.insert("status", QJsonValue(CECSequence::statusName(status)));
+    msg.insert("step", QJsonValue(step));
+    msg.insert("elapsed", QJsonValue(elapsedMs));
+    if (!error.isEmpty())
+    {
+        msg.insert("error", QJsonValue(error));
+    }
+    sendToWebsocket(cec, link, msg, MsgQueue::Control);
+}
+
+void TVCEC::sendState(RemoteLink *link, const QJsonObject &obj)
+{
+    //  {"action":"get_state","epoch":1234,"since":17} answers with the fields changed
+    //  after sequence 17, one message per adapter; no epoch or a stale one gets
+    //  everything. Values come from the store, never from the CEC bus.
+    uint32_t epoch = static_cast<uint32_t>(obj.value("epoch").toVariant().toULongLong());
+    uint64_t since = obj.value("since").toVariant().toULongLong();
+    for (int ii = 0; ii < cecs_.size(); ii++)
+    {
+        bool full;
+        QJsonObject msg = state_.delta(ii, epoch, since, &full);
+        msg.insert("func", QJsonValue("state"));
+        msg.insert("path", QJsonValue("/tvadapter"));
+        msg.insert("epoch", QJsonValue(static_cast<qint64>(state_.epoch())));
+        msg.insert("seq", QJsonValue(static_cast<qint64>(state_.seq())));
+        msg.insert("full", QJsonValue(full));
+        sendToWebsocket(cecs_.at(ii), link, msg, MsgQueue::State);
     }
+    CECLOG(log_, Ws, Debug, "State since %llu sent to %s, now at %llu", static_cast<unsigned long long>(since),
+           qPrintable(link->host()), static_cast<unsigned long long>(state_.seq()));
 }
 
 bool TVCEC::sendQueuedMessages()
 {
     bool ret = true;
+    for (RemoteLink *link : links_)
+    {
+        ret = link->flush() && ret;
+    }
+    scheduleSave();
+    return ret;
+}
 
-    //  Delete expired messages
-    time_t expire;
-    time(&expire);
-    expire -= 30;
-    while (!msg_queue_.isEmpty() && msg_queue_.front().queued < expire)
+static uint32_t remoteId(const RemoteLink *link)
+{
+    QByteArray host = link->host().toUtf8();
+    return StateFile::hash(host.constData(), host.size());
+}
+
+bool TVCEC::setStateFile(const char *filename)
+{
+    //  After the remotes and adapters are set and before init(), so the adapters
+    //  open with the saved state and the remotes get what was still queued
+    stateFile_.close();
+    if (!filename)
     {
-        log_->print(2, "Delete expired message %s expired %d", qPrintable(msg_queue_.front().msg), (int)(expire - msg_queue_.front().queued));
-        msg_queue_.pop_front();
-        ret = false;
+        return true;
     }
+    if (!stateFile_.open(filename))
+    {
+        return false;
+    }
+    if (const StateFile::Snapshot *snap = stateFile_.load())
+    {
+        restoreState(*snap);
+    }
+    saveState();
+    return true;
+}
 
-    if (websocket_->isValid())
+void TVCEC::restoreState(const StateFile::Snapshot &snap)
+{
+    int64_t start = monotonicNs();
+    if (snap.volume >= 0)
     {
-        while (!msg_queue_.isEmpty())
+        volume_ = snap.volume > 100 ? 100 : snap.volume;
+        muted_ = snap.muted != 0;
+        state_.setVolume(volume_);
+        state_.setMuted(muted_);
+        for (CECAudio *cec : cecs_)
         {
-            qint64 sts = websocket_->sendTextMessage(msg_queue_.front().msg);
-            log_->print(2, "Sent %d bytes of %d: %s", sts, msg_queue_.front().msg.size(), qPrintable(msg_queue_.front().msg));
-            msg_queue_.pop_front();
+            cec->setVolume(volume_);
+            cec->setMuted(muted_);
         }
     }
-    else
+    for (int ii = 0; ii < snap.adapters && ii < cecs_.size(); ii++)
+    {
+        //  Another adapter in this place knows nothing of the saved bus
+        const StateFile::Adapter &saved = snap.adapter[ii];
+        CECAudio *cec = cecs_.at(ii);
+        std::string port(saved.port, strnlen(saved.port, sizeof(saved.port)));
+        if (!port.empty() && !cec->port().empty() && port != cec->port())
+        {
+            continue;
+        }
+        CEC::cec_power_status power = saved.power == StateFile::kUnknown ? CEC::CEC_POWER_STATUS_UNKNOWN
+                                                                         : static_cast<CEC::cec_power_status>(saved.power);
+        CEC::cec_logical_address active = saved.active == StateFile::kUnknown ? CEC::CECDEVICE_UNKNOWN
+                                                                             : static_cast<CEC::cec_logical_address>(saved.active);
+        std::string osdname(saved.osdname, strnlen(saved.osdname, sizeof(saved.osdname)));
+        cec->restore(power, active, osdname, saved.physical);
+        if (power != CEC::CEC_POWER_STATUS_UNKNOWN)
+        {
+            state_.setPower(ii, power);
+        }
+        if (active != CEC::CECDEVICE_UNKNOWN)
+        {
+            state_.setActive(ii, active, osdname);
+        }
+    }
+    state_.restore(snap.epoch, snap.seq);
+
+    //  Queue times are only comparable within one boot; expired messages stay dropped
+    int restored = 0;
+    if (stateFile_.sameBoot(snap))
     {
-        log_->print(2, "Open websocket");
-        websocket_->open(QUrl("ws://" + remote_ + "/tvcec"));
+        for (int ii = 0; ii < snap.messages; ii++)
+        {
+            const StateFile::Message &saved = snap.message[ii];
+            if ((saved.deadline != 0 && saved.deadline <= start) || saved.len >= MsgBuffer::kSize ||
+                saved.priority >= MsgQueue::kPriorities || saved.key >= MsgQueue::kKeys)
+            {
+                continue;
+            }
+            MsgBuffer msg;
+            MsgEncoder::copy(msg, saved.data, saved.len);
+            for (RemoteLink *link : links_)
+            {
+                if (remoteId(link) == saved.remote)
+                {
+                    link->restore(msg, static_cast<MsgQueue::Priority>(saved.priority),
+                                  static_cast<MsgQueue::Key>(saved.key), saved.queued, saved.deadline);
+                    restored++;
+                }
+            }
+        }
     }
-    return ret;
+    CECLOG(log_, General, Info, "Warm restart: volume %d%s, %d adapters, %d of %d queued messages, state %u/%llu in %d usec",
+           volume_, muted_ ? " muted" : "", snap.adapters, restored, snap.messages, snap.epoch,
+           static_cast<unsigned long long>(snap.seq), static_cast<int>((monotonicNs() - start) / 1000));
 }
 
-void TVCEC::textMessage(const QString &msg)
+void TVCEC::scheduleSave()
 {
-    QJsonDocument json = QJsonDocument::fromJson(msg.toUtf8());
-    log_->print(2, "Received: %s", qPrintable(msg));
-    QJsonValue act = json.object().value("action");
+    if (stateFile_.isOpen() && !saveTimer_->isActive())
+    {
+        saveTimer_->start();
+    }
+}
+
+void TVCEC::saveState()
+{
+    //  Written straight into the mapped file; the kernel writes it back when it likes
+    StateFile::Snapshot *snap = stateFile_.begin();
+    if (!snap)
+    {
+        return;
+    }
+    snap->epoch = state_.epoch();
+    snap->seq = state_.seq();
+    snap->volume = volume_;
+    snap->muted = muted_;
+    snap->adapters = static_cast<uint8_t>(cecs_.size());
+    for (int ii = 0; ii < cecs_.size() && ii < MsgQueue::kAdapters; ii++)
+    {
+        StateFile::Adapter &saved = snap->adapter[ii];
+        CECAudio *cec = cecs_.at(ii);
+        memset(&saved, 0, sizeof(saved));
+        strncpy(saved.port, cec->port().c_str(), sizeof(saved.port) - 1);
+        for (int la = CEC::CECDEVICE_TV; la < CEC::CECDEVICE_BROADCAST; la++)
+        {
+            saved.physical[la] = cec->topology().physical(static_cast<CEC::cec_logical_address>(la));
+        }
+        saved.physical[CEC::CECDEVICE_BROADCAST] = CECTopology::kUnknown;
+        int power = state_.power(ii);
+        saved.power = power < 0 ? StateFile::kUnknown : static_cast<uint8_t>(power);
+        int active = state_.active(ii);
+        saved.active = active < CEC::CECDEVICE_TV || active >= CEC::CECDEVICE_BROADCAST ? StateFile::kUnknown
+                                                                                         : static_cast<uint8_t>(active);
+        strncpy(saved.osdname, state_.osdName(ii).c_str(), sizeof(saved.osdname) - 1);
+    }
+
+    //  CBOR was encoded for a connection that will be gone, so only JSON is kept
+    int count = 0;
+    for (RemoteLink *link : links_)
+    {
+        uint32_t id = remoteId(link);
+        const MsgQueue &queue = link->queue();
+        for (const MsgQueue::Entry *ent = queue.front(); ent && count < StateFile::kMessages; ent = queue.next(ent))
+        {
+            if (ent->msg.format != MsgBuffer::Json)
+            {
+                continue;
+            }
+            StateFile::Message &saved = snap->message[count++];
+            saved.queued = ent->queued;
+            saved.deadline = ent->deadline;
+            saved.remote = id;
+            saved.priority = ent->priority;
+            saved.key = ent->key;
+            saved.len = ent->msg.len;
+            memcpy(saved.data, ent->msg.data, ent->msg.len + 1);
+        }
+    }
+    snap->messages = static_cast<uint16_t>(count);
+    stateFile_.commit();
+}
+
+void TVCEC::remoteMessage(RemoteLink *link, const QJsonObject &msg)
+{
+    if (link == keyLink_)
+    {
+        keyRepeat_->touch();
+    }
+    QJsonValue act = msg.value("action");
     if (act.isString())
     {
         if (act == "click" || act == "press" || act == "release")
         {
-            QJsonValue lbl = json.object().value("label");
+            QJsonValue lbl = msg.value("label");
             if (lbl.isString())
             {
                 QString label = lbl.toString();
                 if (label == "Vol+" || label == "Vol-")
                 {
-                    QJsonValue rep = json.object().value("repetitions");
+                    QJsonValue rep = msg.value("repetitions");
                     if(!rep.isUndefined())
                     {
-                        int repeat = rep.toString().toInt();
+                        //  The count may arrive as a string or, typically from CBOR remotes, a number
+                        int repeat = rep.isDouble() ? rep.toInt() : rep.toString().toInt();
                         adjustVolume(label, repeat);
                     }
                 }
@@ -285,53 +954,53 @@ void TVCEC::textMessage(const QString &msg)
                 }
             }
         }
+        else if (act == "volume")
+        {
+            setRemoteVolume(msg);
+        }
         else if (act == "cec")
         {
-            doCECCommand(json.object());
+            //  Replies go back to the requesting remote only
+            int adapter = msg.value("adapter").toInt(0);
+            if (adapter < 0 || adapter >= cecs_.size())
+            {
+                CECLOG(log_, CecTx, Warn, "No CEC adapter %d", adapter);
+                return;
+            }
+            doCECCommand(cecs_.at(adapter), link, msg);
+        }
+        else if (act == "get_state")
+        {
+            sendState(link, msg);
         }
     }
 }
 
-void TVCEC::ws_connected()
-{
-    log_->print(2, "Websocket connected %s", qPrintable(websocket_->requestUrl().toString()));
-    // Push power status and active device to front of queue
-    push_to_front_ = true;
-    active_deviceChanged(cec_->getActiveAddress(), cec_->getActiveName());
-    tv_powerChanged(cec_->getTVPower());
-    push_to_front_ = false;
-    sendQueuedMessages();
-
-    health_ = 0;
-    timer_->start();
-}
-
-void TVCEC::ws_disconnected()
+void TVCEC::ws_connected(RemoteLink *link)
 {
-    log_->print(2, "websocket disconnected");
-    timer_->stop();
-    health_ = 0;
+    CECLOG(log_, Ws, Info, "Websocket connected %s", qPrintable(link->socket()->requestUrl().toString()));
+    // Queue power status and active device as state for this remote, replacing any stale state, then flush
+    defer_send_ = true;
+    for (CECAudio *cec : cecs_)
+    {
+        sendActive(cec, link, cec->getActiveAddress(), cec->getActiveName());
+        sendPower(cec, link, cec->getTVPower());
+    }
+    defer_send_ = false;
+    link->flush();
+    scheduleSave();
 }
 
-void TVCEC::ws_pong(quint64 elapsedTime, const QByteArray &payload)
+void TVCEC::ws_disconnected(RemoteLink *link)
 {
-    health_ = 0;
-    if (cec_->log_level() & CEC::CEC_LOG_DEBUG)
+    CECLOG(log_, Ws, Info, "websocket %s disconnected (%s)", qPrintable(link->host()), qPrintable(link->stateReport()));
+    if (link == keyLink_)
     {
-        log_->print(4, "ping/pong elapsed msec: %lld", elapsedTime);
+        keyRepeat_->release();
     }
 }
 
-void TVCEC::healthCheck()
+void TVCEC::ws_pong(RemoteLink *link, quint64 elapsedTime)
 {
-    health_++;
-    if (health_ < 5)
-    {
-        websocket_->ping();
-    }
-    else
-    {
-        log_->print(2, "Health check limit reached! Close websocket.");
-        websocket_->close();
-    }
+    CECLOG(log_, Health, Debug, "%s ping/pong elapsed msec: %lld", qPrintable(link->host()), elapsedTime);
 }
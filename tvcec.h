@@ -4,48 +4,94 @@
 #include <QObject>
 #include <QJsonObject>
 #include <QList>
+#include <QPointer>
+#include <QStringList>
 #include <QTimer>
-#include <QWebSocket>
 #include "cecaudio.h"
+#include "ceckeyrepeat.h"
 #include "ceclog.h"
-#include <time.h>
+#include "cecsequence.h"
+#include "cectrace.h"
+#include "metrics.h"
+#include "volumecoalescer.h"
+#include "msgencoder.h"
+#include "msgqueue.h"
+#include "remotelink.h"
+#include "statefile.h"
+#include "statestore.h"
+#include "tvcecconfig.h"
 
 class TVCEC : public QObject
 {
     Q_OBJECT
+    friend class TVCECBench;
 
 private:
-    CECAudio            *cec_;                  // CEC Audio device
+    CECAudio            *cec_;                  // CEC Audio device (primary adapter)
+    QList<CECAudio *>   cecs_;                  // Every adapter, cec_ first
     CECLog              *log_;                  // Logger
-
-    QString             remote_;                // Remote IP address
-    QWebSocket          *websocket_;            // Websocket to control device
-
+    CECTrace            *trace_;                // CEC flight recorder
+    Metrics             *metrics_;              // Latency histograms and counters
+    MetricsServer       *metricsServer_;        // Prometheus endpoint or null
+    int64_t             origin_;                // Receive time of the CEC frame being handled or 0
+    int64_t             created_;               // Monotonic nsec at construction, for startup timing
+
+    QList<RemoteLink *> links_;                 // Connections to control devices
+    QStringList         remotes_;               // Host each link was made for
+    bool                cborAllowed_;           // Offer CBOR to new links
+    int                 deadlines_[MsgQueue::kPriorities];  // Queue deadlines for new links
+    int                 pingIdle_;              // Ping intervals for new links (msec)
+    int                 pingActive_;
+    bool                started_;               // init() done; new links connect at once
+
+    CECSequence         *sequence_;             // Key and command sequences run locally
+    QPointer<RemoteLink> sequenceLink_;         // Remote that started the running sequence
+    CECKeyRepeat        *keyRepeat_;            // Held key repeats toward CEC devices
+    QPointer<RemoteLink> keyLink_;              // Remote holding the key
+
+    VolumeCoalescer     *coalescer_;            // Volume key burst coalescing
     QTimer              *volTimer_;             // Volume key timer
     int                 volume_;                // Volume
     int                 volCountAdj_;           // Volume count adjustment
     bool                muted_;                 // Sound muted
+    bool                predictive_;            // CECAudio models the volume from key presses
+    StateStore          state_;                 // Versioned state for remote resync
+    StateFile           stateFile_;             // Warm restart state, closed if not kept
+    QTimer              *saveTimer_;            // Coalesces state file saves
     void adjustVolume(const QString &func, int repeat);
-
-    bool sendToWebsocket(const QJsonObject &msg);
-    bool sendButtonClick(const char *label);
-    bool sendButtonPress(const char *label);
-    bool sendButtonRelease(const char *label);
-
-    void doCECCommand(const QJsonObject &obj);
-
-    struct MsgQueEntry
-    {
-        time_t          queued;
-        QString         msg;
-
-        MsgQueEntry(const time_t &t, const QString &m) : queued(t), msg(m) {}
-    };
-    QList<MsgQueEntry>  msg_queue_;
-    bool                push_to_front_;         // Flag to push to front of queue
-
-    QTimer              *timer_;                // Timer for health check
-    int                 health_;                // Health counter
+    void setRemoteVolume(const QJsonObject &obj);
+
+    //  Messages concern adapter cec and go to link, or to every remote when link is null
+    bool sendToWebsocket(CECAudio *cec, RemoteLink *link, const QJsonObject &msg,
+                         MsgQueue::Priority priority = MsgQueue::Telemetry);
+    bool sendToWebsocket(CECAudio *cec, RemoteLink *link, const MsgBuffer &msg,
+                         MsgQueue::Priority priority = MsgQueue::Control, MsgQueue::Key key = MsgQueue::NoKey);
+    bool sendToWebsocket(CECAudio *cec, RemoteLink *link, const MsgBuffer &json, const MsgBuffer &cbor,
+                         MsgQueue::Priority priority, MsgQueue::Key key = MsgQueue::NoKey);
+    bool wantCbor(RemoteLink *target) const;
+    bool sendButtonClick(CECAudio *cec, RemoteLink *link, const char *label,
+                         MsgQueue::Priority priority = MsgQueue::Control, MsgQueue::Key key = MsgQueue::NoKey);
+    bool sendButtonPress(CECAudio *cec, const char *label);
+    bool sendButtonRelease(CECAudio *cec, const char *label);
+    bool sendButtonStep(CECAudio *cec, const char *label, int count);
+    void sendPower(CECAudio *cec, RemoteLink *link, CEC::cec_power_status power);
+    void sendActive(CECAudio *cec, RemoteLink *link, CEC::cec_logical_address logaddr, const std::string &name);
+
+    CECAudio *addAdapter();
+    CECAudio *eventSource() const;
+    int adapterTag(CECAudio *cec) const;
+    bool enqueue(RemoteLink *target, const MsgBuffer &json, const MsgBuffer &cbor, MsgQueue::Priority priority,
+                 MsgQueue::Key key);
+
+    void doCECCommand(CECAudio *cec, RemoteLink *link, const QJsonObject &obj);
+    void startSequence(CECAudio *cec, RemoteLink *link, const QJsonObject &obj);
+    void sendState(RemoteLink *link, const QJsonObject &obj);
+    void restoreState(const StateFile::Snapshot &snap);
+    void scheduleSave();
+    void sendSequenceStatus(CECAudio *cec, RemoteLink *link, const QString &id, CECSequence::Status status, int step,
+                            int elapsedMs, const QString &error);
+
+    bool                defer_send_;            // Queue without sending
 
 public:
     explicit TVCEC(QObject *parent = nullptr);
@@ -53,10 +99,25 @@ public:
 
     bool init();
 
-    void setRemote(const QString &remote) {remote_ = remote;}
-    void setLogLevel(CEC::cec_log_level level) {cec_->setLog_level(level);}
+    void setRemotes(const QStringList &remotes);
+    void setCborAllowed(bool allowed);
+    void setAdapterPorts(const QStringList &ports);
+    void setLogLevel(CEC::cec_log_level level);
+    CECLog *logger() const {return log_;}
     void setLogFile(const char *filename) {log_->setLogFile(filename);}
     void setLogMask(const uint16_t &mask) {log_->setMask(mask);}
+    void setLogRotation(size_t fileSize, size_t totalSize) {log_->setRotation(fileSize, totalSize);}
+    bool setTraceFile(const char *filename, uint32_t records) {return trace_->open(filename, records);}
+    void setQueueDeadline(MsgQueue::Priority priority, int msec);
+    void setPingIntervals(int idleMsec, int activeMsec);
+    void applyConfig(const TVCECConfig &config);
+    void setVolumeCoalescing(VolumeCoalescer::Mode mode, int window) {coalescer_->setMode(mode); coalescer_->setWindow(window);}
+    bool setMetricsPort(quint16 port);
+    void setVolumePrediction(int step);
+    void setAdapter(CECAdapter *adapter) {cec_->setAdapter(adapter);}
+    void setAdapterCache(const char *filename) {cec_->setAdapterCache(filename);}
+    void setKeyRepeat(int interval, int watchdog) {keyRepeat_->setInterval(interval); keyRepeat_->setWatchdog(watchdog);}
+    bool setStateFile(const char *filename);
 
 public slots:
     void tv_powerChanged(CEC::cec_power_status power);
@@ -65,14 +126,17 @@ public slots:
     void volumeDown(bool pressed);
     void setMuted(bool muted);
     void toggleMute();
+    void audioStatusChanged(int volume, bool muted);
+    void keyForcedRelease(CEC::cec_user_control_code key);
+    void sequenceFinished(const QString &id, CECSequence::Status status, int step, int elapsedMs, const QString &error);
 
 private slots:
-    void healthCheck();
     bool sendQueuedMessages();
-    void textMessage(const QString &msg);
-    void ws_connected();
-    void ws_disconnected();
-    void ws_pong(quint64 elapsedTime, const QByteArray &payload);
+    void saveState();
+    void remoteMessage(RemoteLink *link, const QJsonObject &msg);
+    void ws_connected(RemoteLink *link);
+    void ws_disconnected(RemoteLink *link);
+    void ws_pong(RemoteLink *link, quint64 elapsedTime);
 
 signals:
     void volumeChanged(int volume);
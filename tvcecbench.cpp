@@ -0,0 +1,364 @@
+#include <QCborValue>
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "cecaudio.h"
+#include "ceclog.h"
+#include "cecreplay.h"
+#include "cectrace.h"
+#include "metrics.h"
+#include "monotonic.h"
+#include "msgencoder.h"
+#include "remotelink.h"
+#include "tvcec.h"
+
+//  Microbenchmarks for the code that runs on every CEC frame and keypress
+//
+//  Each case is calibrated to run for about kTargetNs, then timed kRuns times.
+//  The median and fastest ns/op and the heap allocations per op are written as
+//  JSON so builds can be compared. Run with -o <file> to write the results to a
+//  file, -filter <text> to run only the cases whose name contains text.
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+class TVCECBench
+{
+private:
+    static const int64_t    kTargetNs = 50000000;   // Time per run
+    static const int        kRuns = 7;              // Timed runs per case
+
+    struct Result
+    {
+        std::string name;
+        uint64_t    iterations;                 // Per run
+        double      median_ns;                  // Median ns/op
+        double      min_ns;                     // Fastest ns/op
+        double      allocs;                     // Heap allocations/op
+    };
+
+    std::vector<Result>     results_;
+    const char              *filter_;
+
+    template <typename F> void run(const std::string &name, F fn);
+
+    void benchCommandHandler();
+    void benchPhysical();
+    void benchSend();
+    void benchRemoteMessage();
+    void benchCodec();
+    void benchLog();
+
+public:
+    explicit TVCECBench(const char *filter) : filter_(filter) {}
+
+    void runAll();
+    void write(FILE *out) const;
+};
+
+template <typename F> void TVCECBench::run(const std::string &name, F fn)
+{
+    if (filter_ && name.find(filter_) == std::string::npos)
+    {
+        return;
+    }
+
+    //  Double the iterations until one run takes a measurable time, then scale to the target
+    uint64_t iters = 1;
+    int64_t elapsed = 0;
+    while (true)
+    {
+        int64_t start = monotonicNs();
+        for (uint64_t ii = 0; ii < iters; ii++)
+        {
+            fn();
+        }
+        elapsed = monotonicNs() - start;
+        if (elapsed > kTargetNs / 10 || iters >= (1ULL << 30))
+        {
+            break;
+        }
+        iters *= 2;
+    }
+    iters = std::max<uint64_t>(1, static_cast<uint64_t>(static_cast<double>(iters) * kTargetNs / std::max<int64_t>(elapsed, 1)));
+
+    std::vector<double> samples;
+    uint64_t allocs = 0;
+    for (int run = 0; run < kRuns; run++)
+    {
+        uint64_t allocs_before = allocations.load(std::memory_order_relaxed);
+        int64_t start = monotonicNs();
+        for (uint64_t ii = 0; ii < iters; ii++)
+        {
+            fn();
+        }
+        int64_t ns = monotonicNs() - start;
+        allocs += allocations.load(std::memory_order_relaxed) - allocs_before;
+        samples.push_back(static_cast<double>(ns) / iters);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Result res;
+    res.name = name;
+    res.iterations = iters;
+    res.median_ns = samples[kRuns / 2];
+    res.min_ns = samples[0];
+    res.allocs = static_cast<double>(allocs) / (static_cast<double>(iters) * kRuns);
+    results_.push_back(res);
+    fprintf(stderr, "%-40s %12.1f ns/op %8.2f allocs/op\n", name.c_str(), res.median_ns, res.allocs);
+}
+
+void TVCECBench::benchCommandHandler()
+{
+    CECLog log;
+    CECTrace trace;
+    Metrics metrics;
+    log.setMask(0);
+    CECAudio audio(&log, &trace, &metrics);
+    audio.setAdapter(new CECReplayAdapter(0));
+    audio.init();
+
+    struct Frame
+    {
+        CEC::cec_logical_address    initiator;
+        CEC::cec_logical_address    destination;
+        CEC::cec_opcode             opcode;
+        uint8_t                     size;
+        uint8_t                     data[4];
+    };
+    static const Frame frames[] =
+    {
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_REPORT_POWER_STATUS, 1, {0x00}},
+        {CEC::CECDEVICE_PLAYBACKDEVICE1, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_SET_OSD_NAME, 4, {'A', 'p', 'p', 'l'}},
+        {CEC::CECDEVICE_PLAYBACKDEVICE1, CEC::CECDEVICE_BROADCAST, CEC::CEC_OPCODE_DEVICE_VENDOR_ID, 3, {0x00, 0x10, 0xfa}},
+        {CEC::CECDEVICE_PLAYBACKDEVICE1, CEC::CECDEVICE_BROADCAST, CEC::CEC_OPCODE_REPORT_PHYSICAL_ADDRESS, 3, {0x10, 0x00, 0x04}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_GIVE_DEVICE_POWER_STATUS, 0, {}},
+        {CEC::CECDEVICE_PLAYBACKDEVICE1, CEC::CECDEVICE_BROADCAST, CEC::CEC_OPCODE_ACTIVE_SOURCE, 2, {0x10, 0x00}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_BROADCAST, CEC::CEC_OPCODE_SET_STREAM_PATH, 2, {0x10, 0x00}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_BROADCAST, CEC::CEC_OPCODE_ROUTING_CHANGE, 4, {0x20, 0x00, 0x10, 0x00}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_GIVE_AUDIO_STATUS, 0, {}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_USER_CONTROL_PRESSED, 1, {0x41}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_USER_CONTROL_RELEASE, 0, {}},
+        {CEC::CECDEVICE_TV, CEC::CECDEVICE_BROADCAST, CEC::CEC_OPCODE_STANDBY, 0, {}},
+    };
+    for (const Frame &frame : frames)
+    {
+        CEC::cec_command command;
+        command.Format(command, frame.initiator, frame.destination, frame.opcode);
+        for (int ii = 0; ii < frame.size; ii++)
+        {
+            command.PushBack(frame.data[ii]);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "processCommand/%02x %s", frame.opcode, CECTrace::opcodeName(frame.opcode));
+        run(name, [&]() {audio.processCommand(command);});
+    }
+
+    //  The libcec callback itself; the worker drains concurrently and drops are counted
+    CEC::cec_command release;
+    release.Format(release, CEC::CECDEVICE_TV, CEC::CECDEVICE_AUDIOSYSTEM, CEC::CEC_OPCODE_USER_CONTROL_RELEASE);
+    run("commandHandler/callback", [&]() {audio.commandHandler(&release);});
+}
+
+void TVCECBench::benchPhysical()
+{
+    CECLog log;
+    CECTrace trace;
+    Metrics metrics;
+    log.setMask(0);
+    CECAudio audio(&log, &trace, &metrics);
+    audio.setAdapter(new CECReplayAdapter(0));
+    audio.init();
+    audio.topology_.update(CEC::CECDEVICE_PLAYBACKDEVICE1, 0x1000);
+    audio.topology_.update(CEC::CECDEVICE_PLAYBACKDEVICE2, 0x2000);
+
+    CEC::cec_datapacket params;
+    params.Clear();
+    params.PushBack(0x20);
+    params.PushBack(0x00);
+    params.PushBack(0x10);
+    params.PushBack(0x00);
+    volatile uint16_t physical = 0;
+    run("physicalFromParameters", [&]() {physical = audio.physicalFromParameters(params, 2);});
+    run("fromPhysical/hit", [&]() {audio.fromPhysical(0x2000);});
+    run("fromPhysical/miss", [&]() {audio.fromPhysical(0x3000);});
+    (void)physical;
+}
+
+void TVCECBench::benchSend()
+{
+    TVCEC tvcec;
+    tvcec.setLogMask(0);
+    tvcec.setAdapter(new CECReplayAdapter(0));
+    tvcec.setRemotes(QStringList() << "127.0.0.1:1");
+    tvcec.cec_->init();
+
+    //  Measure encoding and queueing only; nothing is connected
+    tvcec.defer_send_ = true;
+    run("sendToWebsocket/button", [&]() {tvcec.sendButtonClick(tvcec.cec_, nullptr, "Vol+");});
+    run("sendToWebsocket/state", [&]()
+    {
+        tvcec.sendButtonClick(tvcec.cec_, nullptr, "TVOn", MsgQueue::State, MsgQueue::PowerKey);
+    });
+    run("sendToWebsocket/input", [&]()
+    {
+        MsgBuffer msg;
+        MsgEncoder::inputSelect(msg, CEC::CECDEVICE_PLAYBACKDEVICE1, "Apple TV");
+        tvcec.sendToWebsocket(tvcec.cec_, nullptr, msg, MsgQueue::State, MsgQueue::InputKey);
+    });
+    QJsonObject obj;
+    obj.insert("func", QJsonValue("topology"));
+    obj.insert("path", QJsonValue("/tvadapter"));
+    run("sendToWebsocket/json", [&]() {tvcec.sendToWebsocket(tvcec.cec_, nullptr, obj);});
+    tvcec.defer_send_ = false;
+}
+
+void TVCECBench::benchRemoteMessage()
+{
+    TVCEC tvcec;
+    tvcec.setLogMask(0);
+    tvcec.setAdapter(new CECReplayAdapter(0));
+    tvcec.setRemotes(QStringList() << "127.0.0.1:1");
+    tvcec.cec_->init();
+    RemoteLink *link = tvcec.links_.first();
+
+    //  Decode plus dispatch, as the link does it for each inbound frame
+    QString volume("{\"action\":\"click\",\"label\":\"Vol+\",\"repetitions\":\"3\"}");
+    QString mute("{\"action\":\"click\",\"label\":\"Mute\"}");
+    QString other("{\"action\":\"status\",\"state\":\"idle\"}");
+    QByteArray volumeCbor = QCborValue::fromJsonValue(RemoteLink::decodeJson(volume)).toCbor();
+    run("remoteMessage/volume", [&]() {tvcec.remoteMessage(link, RemoteLink::decodeJson(volume));});
+    run("remoteMessage/volume cbor", [&]() {tvcec.remoteMessage(link, RemoteLink::decodeCbor(volumeCbor));});
+    run("remoteMessage/mute", [&]() {tvcec.remoteMessage(link, RemoteLink::decodeJson(mute));});
+    run("remoteMessage/other", [&]() {tvcec.remoteMessage(link, RemoteLink::decodeJson(other));});
+}
+
+void TVCECBench::benchCodec()
+{
+    //  The two wire formats side by side, without queueing
+    MsgBuffer msg;
+    run("encode/button json", [&]() {MsgEncoder::buttonClick(msg, "Vol+");});
+    run("encode/button cbor", [&]() {MsgEncoder::buttonClick(msg, "Vol+", MsgBuffer::Cbor);});
+    run("encode/input json", [&]() {MsgEncoder::inputSelect(msg, CEC::CECDEVICE_PLAYBACKDEVICE1, "Apple TV");});
+    run("encode/input cbor", [&]()
+    {
+        MsgEncoder::inputSelect(msg, CEC::CECDEVICE_PLAYBACKDEVICE1, "Apple TV", MsgBuffer::Cbor);
+    });
+
+    QJsonObject obj;
+    obj.insert("func", QJsonValue("topology"));
+    obj.insert("path", QJsonValue("/tvadapter"));
+    run("encode/object json", [&]() {QJsonDocument(obj).toJson(QJsonDocument::Compact);});
+    run("encode/object cbor", [&]() {QCborValue::fromJsonValue(obj).toCbor();});
+
+    QString text("{\"action\":\"click\",\"label\":\"Vol+\",\"repetitions\":3}");
+    QByteArray binary = QCborValue::fromJsonValue(RemoteLink::decodeJson(text)).toCbor();
+    run("decode/click json", [&]() {RemoteLink::decodeJson(text);});
+    run("decode/click cbor", [&]() {RemoteLink::decodeCbor(binary);});
+}
+
+void TVCECBench::benchLog()
+{
+    //  The ring drops lines once full, so the enabled cases include the overflow path
+    CECLog log;
+    log.setMask(1);
+    run("CECLOG/volume debug enabled", [&]() {CECLOG(&log, Volume, Debug, "Slot volumeUp %s", "pressed");});
+    run("CECLOG/ws debug filtered", [&]() {CECLOG(&log, Ws, Debug, "Slot volumeUp %s", "pressed");});
+    run("CECLOG/health debug filtered", [&]() {CECLOG(&log, Health, Debug, "Slot volumeUp %s", "pressed");});
+    run("CECLOG/general info", [&]() {CECLOG(&log, General, Info, "Slot volumeUp %s", "pressed");});
+}
+
+void TVCECBench::runAll()
+{
+    benchCommandHandler();
+    benchPhysical();
+    benchSend();
+    benchRemoteMessage();
+    benchCodec();
+    benchLog();
+}
+
+void TVCECBench::write(FILE *out) const
+{
+    fprintf(out, "{\n  \"build\": {\"compiler\": \"%s\", \"qt\": \"%s\", \"built\": \"%s %s\"},\n",
+            __VERSION__, QT_VERSION_STR, __DATE__, __TIME__);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t ii = 0; ii < results_.size(); ii++)
+    {
+        const Result &res = results_[ii];
+        fprintf(out, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, "
+                "\"allocs_per_op\": %.3f}%s\n", res.name.c_str(), static_cast<unsigned long long>(res.iterations),
+                res.median_ns, res.min_ns, res.allocs, ii + 1 < results_.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    const char *outfile = nullptr;
+    const char *filter = nullptr;
+    for (int ii = 1; ii < argc; ii++)
+    {
+        if (strcmp(argv[ii], "-o") == 0 && ii + 1 < argc)
+        {
+            outfile = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-filter") == 0 && ii + 1 < argc)
+        {
+            filter = argv[++ii];
+        }
+    }
+
+    //  The logger always echoes to stdout; keep the results apart from it
+    FILE *out = outfile ? fopen(outfile, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (!out)
+    {
+        fprintf(stderr, "Cannot open %s\n", outfile ? outfile : "stdout");
+        return 1;
+    }
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0)
+    {
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+
+    TVCECBench bench(filter);
+    bench.runAll();
+    bench.write(out);
+    fclose(out);
+    return 0;
+}
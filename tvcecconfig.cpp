@@ -0,0 +1,219 @@
+#include "tvcecconfig.h"
+#include "ceclog.h"
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSettings>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <libcec/cec.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+TVCECConfig::TVCECConfig() : logLevel(CEC::CEC_LOG_ERROR), logMask(0xff), audioStatusDelay(500), volumeTimer(3000),
+    pingIdle(30000), pingActive(2000)
+{
+    MsgQueue defaults;
+    for (int ii = 0; ii < MsgQueue::kPriorities; ii++)
+    {
+        deadlines[ii] = defaults.deadline(static_cast<MsgQueue::Priority>(ii));
+    }
+}
+
+bool TVCECConfig::load(const QString &filename, QString *error)
+{
+    if (!QFileInfo(filename).isReadable())
+    {
+        if (error)
+        {
+            *error = QString("cannot read %1").arg(filename);
+        }
+        return false;
+    }
+    QSettings ini(filename, QSettings::IniFormat);
+    if (ini.status() != QSettings::NoError)
+    {
+        if (error)
+        {
+            *error = QString("format error in %1").arg(filename);
+        }
+        return false;
+    }
+
+    //  Read into a copy so a bad file changes nothing
+    TVCECConfig config;
+    for (const QString &host : ini.value("remote/hosts").toStringList())
+    {
+        if (!host.trimmed().isEmpty())
+        {
+            config.remotes << host.trimmed();
+        }
+    }
+    for (const QString &port : ini.value("cec/adapters").toStringList())
+    {
+        if (!port.trimmed().isEmpty())
+        {
+            config.adapters << port.trimmed();
+        }
+    }
+    for (const QString &level : ini.value("log/cec").toStringList())
+    {
+        QString name = level.trimmed().toLower();
+        if (name == "warning") config.logLevel |= CEC::CEC_LOG_WARNING;
+        else if (name == "notice") config.logLevel |= CEC::CEC_LOG_NOTICE;
+        else if (name == "traffic") config.logLevel |= CEC::CEC_LOG_TRAFFIC;
+        else if (name == "debug") config.logLevel |= CEC::CEC_LOG_DEBUG;
+        else if (name == "all") config.logLevel |= CEC::CEC_LOG_ALL;
+        else if (name != "error" && !name.isEmpty())
+        {
+            if (error)
+            {
+                *error = QString("unknown CEC log level %1 in %2").arg(level.trimmed(), filename);
+            }
+            return false;
+        }
+    }
+    for (const QString &level : ini.value("log/levels").toStringList())
+    {
+        QString entry = level.trimmed().toLower();
+        if (entry.isEmpty())
+        {
+            continue;
+        }
+        LogCategory category;
+        LogLevel value;
+        if (!CECLog::parseCategory(entry.section(':', 0, 0).trimmed().toLatin1().constData(), &category) ||
+            !CECLog::parseLevel(entry.section(':', 1).trimmed().toLatin1().constData(), &value))
+        {
+            if (error)
+            {
+                *error = QString("bad log level %1 in %2").arg(level.trimmed(), filename);
+            }
+            return false;
+        }
+        config.logLevels << QString("%1:%2").arg(CECLog::categoryName(category), CECLog::levelName(value));
+    }
+    config.logFile = ini.value("log/file").toString().trimmed();
+
+    struct
+    {
+        const char      *key;
+        int             *value;
+    } numbers[] =
+    {
+        {"log/mask", &config.logMask},
+        {"queue/state", &config.deadlines[MsgQueue::State]},
+        {"queue/control", &config.deadlines[MsgQueue::Control]},
+        {"queue/telemetry", &config.deadlines[MsgQueue::Telemetry]},
+        {"timers/audio_status", &config.audioStatusDelay},
+        {"timers/volume", &config.volumeTimer},
+        {"remote/ping_idle", &config.pingIdle},
+        {"remote/ping_active", &config.pingActive},
+    };
+    for (auto &number : numbers)
+    {
+        QVariant value = ini.value(number.key);
+        if (!value.isValid())
+        {
+            continue;
+        }
+        bool ok;
+        int val = value.toString().trimmed().toInt(&ok, 0);
+        if (!ok || val < 0)
+        {
+            if (error)
+            {
+                *error = QString("bad value %1 for %2 in %3").arg(value.toString(), number.key, filename);
+            }
+            return false;
+        }
+        *number.value = val;
+    }
+
+    *this = config;
+    return true;
+}
+
+int TVCECConfigWatcher::signalFd_[2] = {-1, -1};
+
+TVCECConfigWatcher::TVCECConfigWatcher(const QString &filename, QObject *parent) : QObject{parent},
+    filename_(filename), notifier_(nullptr)
+{
+    settle_ = new QTimer(this);
+    settle_->setSingleShot(true);
+    settle_->setInterval(200);
+    connect(settle_, &QTimer::timeout, this, [this]()
+    {
+        if (!filename_.isEmpty() && !watcher_->files().contains(filename_))
+        {
+            watcher_->addPath(filename_);
+        }
+        emit reload();
+    });
+
+    watcher_ = new QFileSystemWatcher(this);
+    if (!filename_.isEmpty())
+    {
+        watcher_->addPath(filename_);
+    }
+    connect(watcher_, &QFileSystemWatcher::fileChanged, this, &TVCECConfigWatcher::fileChanged);
+
+    //  The handler may only write to a descriptor; the notifier brings it to the event loop.
+    //  Both ends are non-blocking so the handler never waits on a full buffer.
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, signalFd_) == 0)
+    {
+        notifier_ = new QSocketNotifier(signalFd_[1], QSocketNotifier::Read, this);
+        connect(notifier_, &QSocketNotifier::activated, this, &TVCECConfigWatcher::signalled);
+        struct sigaction sa = {};
+        sa.sa_handler = &TVCECConfigWatcher::handleSignal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGHUP, &sa, nullptr);
+    }
+}
+
+TVCECConfigWatcher::~TVCECConfigWatcher()
+{
+    if (notifier_)
+    {
+        signal(SIGHUP, SIG_DFL);
+        delete notifier_;
+        ::close(signalFd_[0]);
+        ::close(signalFd_[1]);
+        signalFd_[0] = signalFd_[1] = -1;
+    }
+}
+
+void TVCECConfigWatcher::handleSignal(int)
+{
+    char ch = 1;
+    if (::write(signalFd_[0], &ch, sizeof(ch)) < 0)
+    {
+        //  Buffer full: a reload is pending anyway
+    }
+}
+
+void TVCECConfigWatcher::signalled()
+{
+    //  Several SIGHUPs since the last look give one reload
+    char buf[64];
+    bool pending = false;
+    while (::read(signalFd_[1], buf, sizeof(buf)) > 0)
+    {
+        pending = true;
+    }
+    if (pending)
+    {
+        emit reload();
+    }
+}
+
+void TVCECConfigWatcher::fileChanged()
+{
+    //  An editor that saves by rename leaves the watch on the old file
+    if (!watcher_->files().contains(filename_) && QFileInfo::exists(filename_))
+    {
+        watcher_->addPath(filename_);
+    }
+    settle_->start();
+}
@@ -0,0 +1,86 @@
+#ifndef TVCECCONFIG_H
+#define TVCECCONFIG_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include "msgqueue.h"
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+class QTimer;
+
+//  Settings read from the tvcec config file (INI format)
+//
+//      [remote]
+//      hosts = tvremote.local, blaster.local:8080
+//      ping_idle = 30000
+//      ping_active = 2000
+//
+//      [cec]
+//      adapters = /dev/ttyACM0, /dev/ttyACM1
+//
+//      [log]
+//      cec = warning, notice
+//      mask = 3
+//      levels = ws:debug, cec.rx:trace
+//      file = /var/log/tvcec.log
+//
+//      [queue]
+//      state = 0
+//      control = 5000
+//      telemetry = 30000
+//
+//      [timers]
+//      audio_status = 500
+//      volume = 3000
+//
+//  Times are msec. Anything left out has its default.
+struct TVCECConfig
+{
+    QStringList         remotes;                // Remote hosts (host or host:port)
+    QStringList         adapters;               // CEC adapter ports, empty to detect one
+    int                 logLevel;               // CEC log levels (CEC::cec_log_level bits)
+    int                 logMask;                // tvcec log detail mask
+    QStringList         logLevels;              // Category levels over the mask, "category:level"
+    QString             logFile;                // Log file, empty for none
+    int                 deadlines[MsgQueue::kPriorities];  // Queue lifetime per priority, 0 never
+    int                 audioStatusDelay;       // Volume key to audio status report
+    int                 volumeTimer;            // Volume key burst window
+    int                 pingIdle;               // Remote ping interval when idle
+    int                 pingActive;             // Remote ping interval while traffic flows
+
+    TVCECConfig();
+
+    bool load(const QString &filename, QString *error = nullptr);
+};
+
+//  Tells when the config file should be read again: on SIGHUP, or when the
+//  file is written. Editors that replace the file are followed, and a burst of
+//  writes gives one reload. Without a file only SIGHUP is watched.
+class TVCECConfigWatcher : public QObject
+{
+    Q_OBJECT
+
+private:
+    QString             filename_;              // Config file
+    QFileSystemWatcher  *watcher_;              // File change notices
+    QSocketNotifier     *notifier_;             // SIGHUP, through a socket pair
+    QTimer              *settle_;               // Waits for writes to finish
+
+    static int          signalFd_[2];           // Written by the signal handler
+    static void handleSignal(int signal);
+
+private slots:
+    void fileChanged();
+    void signalled();
+
+public:
+    explicit TVCECConfigWatcher(const QString &filename, QObject *parent = nullptr);
+    virtual ~TVCECConfigWatcher();
+
+signals:
+    void reload();
+};
+
+#endif // TVCECCONFIG_H
@@ -0,0 +1,86 @@
+#include "volumecoalescer.h"
+#include <string.h>
+
+VolumeCoalescer::VolumeCoalescer(QObject *parent) : QObject{parent}, mode_(Hold), window_(300), release_guard_(600),
+    label_(nullptr), count_(0), source_(0)
+{
+    timer_ = new QTimer(this);
+    timer_->setSingleShot(true);
+    timer_->setTimerType(Qt::PreciseTimer);
+    connect(timer_, &QTimer::timeout, this, &VolumeCoalescer::timeout);
+}
+
+void VolumeCoalescer::setWindow(int msec)
+{
+    window_ = msec > 0 ? msec : 0;
+    //  CEC repeats a held key at least every 450 msec
+    release_guard_ = window_ > 500 ? window_ : 500 + window_ / 2;
+}
+
+void VolumeCoalescer::keyEvent(const char *label, bool pressed, int source)
+{
+    //  A different key or source ends the current burst
+    if (label_ && (strcmp(label_, label) != 0 || source != source_))
+    {
+        endBurst();
+    }
+
+    if (pressed)
+    {
+        if (!label_)
+        {
+            label_ = label;
+            source_ = source;
+            count_ = 0;
+            if (mode_ == Hold)
+            {
+                emit holdStart(label_);
+            }
+        }
+        count_++;
+        //  Guard against a release that never arrives
+        timer_->start(release_guard_);
+    }
+    else if (label_)
+    {
+        //  A held key ends with its release; counting presses for a step waits for more
+        if (mode_ == Hold)
+        {
+            endBurst();
+        }
+        else
+        {
+            timer_->start(window_);
+        }
+    }
+}
+
+void VolumeCoalescer::flush()
+{
+    if (label_)
+    {
+        endBurst();
+    }
+}
+
+void VolumeCoalescer::timeout()
+{
+    endBurst();
+}
+
+void VolumeCoalescer::endBurst()
+{
+    timer_->stop();
+    const char *label = label_;
+    int count = count_;
+    label_ = nullptr;
+    count_ = 0;
+    if (mode_ == Hold)
+    {
+        emit holdStop(label);
+    }
+    else if (count > 0)
+    {
+        emit step(label, count);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef VOLUMECOALESCER_H
+#define VOLUMECOALESCER_H
+
+#include <QObject>
+#include <QTimer>
+
+//  Collapses CEC volume key repeat bursts
+//
+//  In Hold mode a burst becomes one holdStart when it begins and one holdStop
+//  as soon as the key is released; the repeated presses in between are merged.
+//  In Step mode the burst ends once no key event has arrived for the coalescing
+//  window and is reported as a single step with the number of presses seen. Each
+//  burst belongs to one source (a CEC adapter index); a key from another
+//  source ends it, and source() tells whose burst a signal reports.
+class VolumeCoalescer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Mode
+    {
+        Hold,
+        Step
+    };
+
+private:
+    Mode                mode_;                  // Coalescing mode
+    int                 window_;                // Quiet time that ends a Step burst (msec)
+    int                 release_guard_;         // Quiet time after a press with no release (msec)
+    QTimer              *timer_;                // Burst end timer
+    const char          *label_;                // Key in the current burst or null
+    int                 count_;                 // Presses in the current burst
+    int                 source_;                // Source of the current or last burst
+
+    void endBurst();
+
+public:
+    explicit VolumeCoalescer(QObject *parent = nullptr);
+
+    void setMode(Mode mode) {mode_ = mode;}
+    Mode mode() const {return mode_;}
+    void setWindow(int msec);
+    int window() const {return window_;}
+    int source() const {return source_;}
+
+public slots:
+    void keyEvent(const char *label, bool pressed, int source = 0);
+    void flush();
+
+private slots:
+    void timeout();
+
+signals:
+    void holdStart(const char *label);
+    void holdStop(const char *label);
+    void step(const char *label, int count);
+};
+
+#endif // VOLUMECOALESCER_H